@@ -0,0 +1,100 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   CgiEnv.cpp                                         :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/20 11:06:52 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/20 16:37:21 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "CgiEnv.hpp"
+
+#include <string.h>  // strlen, strchr
+
+#include <cctype>  // toupper
+
+#include "FastCgi.hpp"
+
+/*
+** constructor / destructor
+*/
+
+CgiEnv::CgiEnv() {}
+
+CgiEnv::~CgiEnv() {}
+
+/*
+** function: clear
+*/
+
+void CgiEnv::clear() {
+  arena_.clear();
+  vars_.clear();
+}
+
+/*
+** function: add
+*/
+
+void CgiEnv::add(const char* name, const char* value, size_t value_len) {
+  vars_.push_back(arena_.size());
+  arena_.insert(arena_.end(), name, name + strlen(name));
+  arena_.push_back('=');
+  arena_.insert(arena_.end(), value, value + value_len);
+  arena_.push_back('\0');
+}
+
+void CgiEnv::add(const char* name, const std::string& value) {
+  add(name, value.data(), value.size());
+}
+
+/*
+** function: addHeader
+**
+** (name is converted in arena, not in a temporary string)
+*/
+
+void CgiEnv::addHeader(const char* name, size_t name_len, const char* value,
+                       size_t value_len) {
+  static const char prefix[] = "HTTP_";
+
+  vars_.push_back(arena_.size());
+  arena_.insert(arena_.end(), prefix, prefix + sizeof(prefix) - 1);
+  for (size_t i = 0; i < name_len; ++i) {
+    unsigned char c = name[i];
+    arena_.push_back(c == '-' ? '_' : static_cast<char>(std::toupper(c)));
+  }
+  arena_.push_back('=');
+  arena_.insert(arena_.end(), value, value + value_len);
+  arena_.push_back('\0');
+}
+
+/*
+** function: getEnvp
+**
+** pointers are made here because arena_ may move while adding variables
+*/
+
+char* const* CgiEnv::getEnvp() {
+  envp_.clear();
+  for (size_t i = 0; i < vars_.size(); ++i) {
+    envp_.push_back(&arena_[vars_[i]]);
+  }
+  envp_.push_back(NULL);
+  return &envp_[0];
+}
+
+/*
+** function: appendFcgiParams
+*/
+
+void CgiEnv::appendFcgiParams(std::string* params) const {
+  for (size_t i = 0; i < vars_.size(); ++i) {
+    const char* var = &arena_[vars_[i]];
+    const char* value = strchr(var, '=') + 1;
+    appendFcgiParam(params, var, value - 1 - var, value, strlen(value));
+  }
+}
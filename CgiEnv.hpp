@@ -0,0 +1,63 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   CgiEnv.hpp                                         :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/20 11:06:52 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/20 16:37:21 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef CGIENV_HPP
+#define CGIENV_HPP
+
+#include <stddef.h>  // size_t
+
+#include <string>
+#include <vector>
+
+/*
+** meta-variables of cgi built in one contiguous arena
+**
+** variables are stored as "NAME=value\0" one after another in a buffer
+** reused for next requests, and envp passed to cgi script points into it.
+** no string is allocated for each variable (nor anything at all once the
+** buffer has grown enough). the same variables are sent to cgi worker as
+** FastCGI params.
+*/
+
+class CgiEnv {
+ private:
+  std::vector<char> arena_;    // variables ("NAME=value\0" each)
+  std::vector<size_t> vars_;   // offset of each variable in arena_
+  std::vector<char*> envp_;    // pointers to variables (built by getEnvp)
+
+  // do not allow copy and assignation
+  CgiEnv(const CgiEnv& ref);
+  CgiEnv& operator=(const CgiEnv& ref);
+
+ public:
+  CgiEnv();
+  ~CgiEnv();
+
+  // remove all variables (memory is kept)
+  void clear();
+
+  // add a variable
+  void add(const char* name, const char* value, size_t value_len);
+  void add(const char* name, const std::string& value);
+
+  // add a header field as HTTP_NAME (upper case, '-' is replaced by '_')
+  void addHeader(const char* name, size_t name_len, const char* value,
+                 size_t value_len);
+
+  // returns environment for execve (valid until variables are changed)
+  char* const* getEnvp();
+
+  // append all variables to content of FCGI_PARAMS
+  void appendFcgiParams(std::string* params) const;
+};
+
+#endif /* CGIENV_HPP */
@@ -0,0 +1,246 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   CgiPool.cpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/19 10:31:27 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/22 19:03:27 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "CgiPool.hpp"
+
+#include <errno.h>
+#include <fcntl.h>   // fcntl
+#include <signal.h>  // kill
+#include <spawn.h>   // posix_spawn
+#include <sys/socket.h>
+#include <unistd.h>  // close
+
+#include <algorithm>
+
+#include "Logger.hpp"
+
+/*
+** pool of current thread
+*/
+
+static __thread CgiPool* g_cgi_pool = NULL;
+
+/*
+** constructor
+**
+** no worker is started until a request needs it
+*/
+
+CgiPool::CgiPool() : workers_(CGI_POOL_SIZE), n_busy_(0) {
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    workers_[i].pid = -1;
+    workers_[i].fd = -1;
+    workers_[i].busy = false;
+  }
+}
+
+/*
+** destructor
+**
+** stop all workers
+*/
+
+CgiPool::~CgiPool() {
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    stop(&workers_[i]);
+  }
+}
+
+/*
+** function: getLocal
+*/
+
+CgiPool& CgiPool::getLocal() {
+  if (g_cgi_pool == NULL) {
+    g_cgi_pool = new CgiPool;
+  }
+  return *g_cgi_pool;
+}
+
+/*
+** function: getIdleNum
+**
+** (workers not started yet are counted as they are started on acquire)
+*/
+
+int CgiPool::getIdleNum() const {
+  return static_cast<int>(workers_.size()) - n_busy_;
+}
+
+/*
+** function: spawnProcess
+**
+** start a process by posix_spawn
+**    - process is created with vfork semantics (parent's memory is not
+**      copied), so it costs the same however large the server is
+**    - fds are set by file actions in child, other fds of server are not
+**      inherited (all of them are close-on-exec, and dup2 clears it)
+**    - signals ignored by server (SIGPIPE, SIGCHLD) are reset to default
+*/
+
+int CgiPool::spawnProcess(const char* path, int in_fd, int out_fd,
+                          char* const* envp, pid_t* pid) {
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t sigdefault;
+  char* argv[] = {const_cast<char*>(path), NULL};
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, in_fd, 0);
+  if (out_fd >= 0) {
+    posix_spawn_file_actions_adddup2(&actions, out_fd, 1);
+  }
+  posix_spawnattr_init(&attr);
+  sigemptyset(&sigdefault);
+  sigaddset(&sigdefault, SIGPIPE);
+  sigaddset(&sigdefault, SIGCHLD);
+  posix_spawnattr_setsigdefault(&attr, &sigdefault);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+  int err = posix_spawn(pid, path, &actions, &attr, argv, envp);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (err != 0) {
+    errno = err;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+** function: spawn
+**
+** start a worker process connected by socketpair
+** (socket is passed as fd 0 of worker, as FastCGI does)
+*/
+
+int CgiPool::spawn(CgiWorker* worker) {
+  int sv[2];
+  char* envp[] = {NULL};
+  pid_t pid;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) == -1) {
+    LOG_ERROR("failed to start cgi worker " CGI_WORKER_PATH);
+    return -1;
+  }
+  int ret = spawnProcess(CGI_WORKER_PATH, sv[1], -1, envp, &pid);
+  close(sv[1]);
+  if (ret == -1) {
+    close(sv[0]);
+    LOG_ERROR("failed to start cgi worker " CGI_WORKER_PATH);
+    return -1;
+  }
+  fcntl(sv[0], F_SETFL, O_NONBLOCK);
+  worker->pid = pid;
+  worker->fd = sv[0];
+  LOG_INFO("cgi worker " << pid << " started");
+  return 0;
+}
+
+/*
+** function: stop
+**
+** kill worker process and close its socket
+** (process is reaped by kernel because SIGCHLD is ignored)
+*/
+
+void CgiPool::stop(CgiWorker* worker) {
+  if (worker->pid > 0) {
+    kill(worker->pid, SIGKILL);
+  }
+  if (worker->fd >= 0) {
+    close(worker->fd);
+  }
+  worker->pid = -1;
+  worker->fd = -1;
+}
+
+/*
+** function: isAlive
+**
+** check if idle worker is still running
+**    - closed socket (EOF) means the process exited
+**    - idle worker must not send anything
+*/
+
+bool CgiPool::isAlive(const CgiWorker& worker) {
+  char c;
+
+  return recv(worker.fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == -1 &&
+         (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/*
+** function: acquire
+**
+** get idle worker (or start one in empty slot) and mark it busy
+*/
+
+int CgiPool::acquire(int key, CgiWorker** worker) {
+  CgiWorker* found = NULL;
+
+  // running worker is preferred to empty slot
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    CgiWorker* candidate = &workers_[i];
+    if (candidate->busy) {
+      continue;
+    } else if (candidate->pid > 0 && !isAlive(*candidate)) {
+      LOG_WARN("cgi worker " << candidate->pid << " exited, restart it");
+      stop(candidate);
+    }
+    if (found == NULL || (found->pid == -1 && candidate->pid > 0)) {
+      found = candidate;
+    }
+    if (found->pid > 0) {
+      break;
+    }
+  }
+
+  if (found == NULL) {
+    if (std::find(waiting_.begin(), waiting_.end(), key) == waiting_.end()) {
+      waiting_.push_back(key);  // (woken up by other fd, still in queue)
+    }
+    return 1;
+  } else if (found->pid == -1 && spawn(found) == -1) {
+    return -1;
+  }
+  found->busy = true;
+  ++n_busy_;
+  *worker = found;
+  return 0;
+}
+
+/*
+** function: release
+*/
+
+void CgiPool::release(CgiWorker* worker, bool broken) {
+  if (broken) {
+    LOG_WARN("cgi worker " << worker->pid << " is broken, restart it");
+    stop(worker);
+  }
+  worker->busy = false;
+  --n_busy_;
+}
+
+/*
+** function: popWaiting
+*/
+
+int CgiPool::popWaiting() {
+  if (waiting_.empty()) {
+    return -1;
+  }
+  int key = waiting_.front();
+  waiting_.pop_front();
+  return key;
+}
@@ -0,0 +1,81 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   CgiPool.hpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/19 10:31:27 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/20 16:37:21 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef CGIPOOL_HPP
+#define CGIPOOL_HPP
+
+#include <sys/types.h>  // pid_t
+
+#include <deque>
+#include <vector>
+
+#include "config.hpp"
+
+// a long-lived cgi process connected by a unix socket
+struct CgiWorker {
+  pid_t pid;  // pid of process (-1 if not running)
+  int fd;     // socket connected to fd 0 of process (non blocking)
+  bool busy;  // processing a request of a session
+};
+
+/*
+** pool of cgi workers of one event loop
+**
+** workers are started when needed (up to CGI_POOL_SIZE) and kept for next
+** requests. a session gets an idle worker for a request, and waits in
+** queue if all of them are busy (woken up by Server when one is released).
+** a worker which crashed or was left in the middle of a request is killed
+** and replaced by a new process next time.
+*/
+
+class CgiPool {
+ private:
+  std::vector<CgiWorker> workers_;
+  std::deque<int> waiting_;  // keys of sessions waiting for a worker
+  int n_busy_;               // number of busy workers
+
+  CgiPool();
+
+  // do not allow copy and assignation
+  CgiPool(const CgiPool& ref);
+  CgiPool& operator=(const CgiPool& ref);
+
+  int spawn(CgiWorker* worker);
+  void stop(CgiWorker* worker);
+  static bool isAlive(const CgiWorker& worker);
+
+ public:
+  ~CgiPool();
+
+  // returns pool of current thread (created at first call)
+  static CgiPool& getLocal();
+
+  // start program of path with in_fd and out_fd as its stdin and stdout
+  // (out_fd -1 keeps stdout, returns -1 and errno is set if failed)
+  static int spawnProcess(const char* path, int in_fd, int out_fd,
+                          char* const* envp, pid_t* pid);
+
+  // returns number of workers which can take a request now
+  int getIdleNum() const;
+
+  // get an idle worker for session of key
+  // (returns 0 if got, 1 if queued to wait, -1 if no worker can be started)
+  int acquire(int key, CgiWorker** worker);
+
+  // return worker after a request (broken if it cannot take next one)
+  void release(CgiWorker* worker, bool broken);
+
+  // returns key of a session waiting for a worker (or -1 if none)
+  int popWaiting();
+};
+
+#endif /* CGIPOOL_HPP */
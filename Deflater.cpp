@@ -0,0 +1,159 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Deflater.cpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/24 10:12:40 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/24 10:12:40 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Deflater.hpp"
+
+#include <string.h>  // memset
+
+#include "config.hpp"
+
+/*
+** function: getWindowBits
+**
+** windowBits for deflateInit2 (+16 makes gzip header and trailer)
+*/
+
+static int getWindowBits(ContentCoding coding) {
+  return coding == CODING_GZIP ? MAX_WBITS + 16 : MAX_WBITS;
+}
+
+/*
+** constructor / destructor
+*/
+
+Deflater::Deflater() : active_(false) { memset(&stream_, 0, sizeof(stream_)); }
+
+Deflater::~Deflater() { end(); }
+
+/*
+** function: start
+**
+** stream not ended yet is ended before starting new one
+*/
+
+int Deflater::start(ContentCoding coding, int level) {
+  end();
+  memset(&stream_, 0, sizeof(stream_));
+  if (coding == CODING_IDENTITY ||
+      deflateInit2(&stream_, level, Z_DEFLATED, getWindowBits(coding), 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return -1;
+  }
+  active_ = true;
+  return 0;
+}
+
+/*
+** function: compress
+**
+** output is written directly into free space of out
+*/
+
+int Deflater::compress(const char* data, size_t len, IoBuffer* out,
+                       int flush) {
+  stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  stream_.avail_in = len;
+  do {
+    size_t space;
+    char* dst = out->prepareWrite(&space);
+    stream_.next_out = reinterpret_cast<Bytef*>(dst);
+    stream_.avail_out = space;
+    int ret = deflate(&stream_, flush);
+    if (ret == Z_STREAM_ERROR) {
+      return -1;
+    }
+    out->commitWrite(space - stream_.avail_out);
+    if (ret == Z_STREAM_END) {
+      break;
+    }
+  } while (stream_.avail_out == 0);  // not all output is written yet
+  return 0;
+}
+
+int Deflater::compress(IoBuffer* in, IoBuffer* out, int flush) {
+  size_t off = in->getBegin();
+  size_t end = in->getEnd();
+
+  if (off == end) {
+    return flush == Z_NO_FLUSH ? 0 : compress(NULL, 0, out, flush);
+  }
+  while (off < end) {
+    size_t len;
+    const char* data = in->peek(off, &len);
+    off += len;
+    if (compress(data, len, out, off == end ? flush : Z_NO_FLUSH) == -1) {
+      return -1;
+    }
+  }
+  in->consumeTo(end);
+  return 0;
+}
+
+/*
+** function: end
+*/
+
+void Deflater::end() {
+  if (active_) {
+    deflateEnd(&stream_);
+    active_ = false;
+  }
+}
+
+/*
+** function: isActive
+*/
+
+bool Deflater::isActive() const { return active_; }
+
+/*
+** function: compressAll
+**
+** output buffer is made large enough (deflateBound) to finish in one call
+*/
+
+int Deflater::compressAll(ContentCoding coding, int level, const char* data,
+                          size_t len, std::string* out) {
+  Deflater deflater;
+
+  if (deflater.start(coding, level) == -1) {
+    return -1;
+  }
+  out->resize(deflateBound(&deflater.stream_, len) + 32);
+  deflater.stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  deflater.stream_.avail_in = len;
+  deflater.stream_.next_out = reinterpret_cast<Bytef*>(&(*out)[0]);
+  deflater.stream_.avail_out = out->size();
+  if (deflate(&deflater.stream_, Z_FINISH) != Z_STREAM_END) {
+    out->clear();
+    return -1;
+  }
+  out->resize(out->size() - deflater.stream_.avail_out);
+  return 0;
+}
+
+/*
+** function: isCompressible
+**
+** checks extension of last component of path
+*/
+
+bool Deflater::isCompressible(const std::string& path) {
+  static const std::string extensions =
+      std::string(" ") + COMPRESS_EXTENSIONS + " ";
+  size_t dot = path.rfind('.');
+
+  if (dot == std::string::npos || path.find('/', dot) != std::string::npos) {
+    return false;
+  }
+  return extensions.find(" " + path.substr(dot) + " ") != std::string::npos;
+}
@@ -0,0 +1,68 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Deflater.hpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/24 10:12:40 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/24 10:12:40 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef DEFLATER_HPP
+#define DEFLATER_HPP
+
+#include <zlib.h>
+
+#include <string>
+
+#include "IoBuffer.hpp"
+#include "http.hpp"
+
+/*
+** compressor of response body in gzip or deflate coding (by zlib)
+**
+** a stream is started for each response and its output is appended to
+** IoBuffer, so that a body produced in pieces (e.g. output of cgi) can be
+** compressed piece by piece. whole data (e.g. a static file) can be
+** compressed at once by compressAll.
+*/
+
+class Deflater {
+ private:
+  z_stream stream_;  // state of zlib
+  bool active_;      // stream is started and not ended
+
+  // do not allow copy and assignation
+  Deflater(const Deflater& ref);
+  Deflater& operator=(const Deflater& ref);
+
+ public:
+  Deflater();
+  ~Deflater();
+
+  // start a stream (returns -1 if failed)
+  int start(ContentCoding coding, int level);
+
+  // compress data and append output to out (returns -1 if failed)
+  // flush is Z_NO_FLUSH, Z_SYNC_FLUSH (send all so far) or Z_FINISH (end)
+  int compress(const char* data, size_t len, IoBuffer* out, int flush);
+
+  // compress all data in `in` (consumed)
+  int compress(IoBuffer* in, IoBuffer* out, int flush);
+
+  // free the stream
+  void end();
+
+  bool isActive() const;
+
+  // compress whole data into out (returns -1 if failed)
+  static int compressAll(ContentCoding coding, int level, const char* data,
+                         size_t len, std::string* out);
+
+  // whether file at path is worth compressing (by COMPRESS_EXTENSIONS)
+  static bool isCompressible(const std::string& path);
+};
+
+#endif /* DEFLATER_HPP */
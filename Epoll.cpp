@@ -0,0 +1,382 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Epoll.cpp                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/02 10:24:40 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/28 18:40:00 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Epoll.hpp"
+
+#include <errno.h>
+#include <string.h>  // memset
+#include <unistd.h>  // close
+
+#include <stdexcept>
+
+// user_data of removal of poll (its completion is ignored)
+#define URING_CANCEL_DATA 0xffffffffffffffffULL
+
+// flag of user_data of UringOp (rest is its address), not set for polls
+#define URING_OP_FLAG 0x8000000000000000ULL
+
+/*
+** epoll of worker running in current thread
+*/
+
+static __thread Epoll* g_epoll = NULL;
+
+/*
+** default constructor
+**
+** epoll instance is created in init()
+*/
+
+Epoll::Epoll() : fd_(-1), edge_triggered_(false), use_uring_(false) {}
+
+/*
+** destructor
+**
+** close epoll instance if opened
+*/
+
+Epoll::~Epoll() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+/*
+** getters
+*/
+
+int Epoll::getFd() const { return fd_; }
+bool Epoll::isEdgeTriggered() const { return edge_triggered_; }
+bool Epoll::isUring() const { return use_uring_; }
+
+/*
+** function: getLocal / makeLocal
+**
+** makeLocal is called by worker in its thread (not in init, which is done
+** in main thread)
+*/
+
+Epoll* Epoll::getLocal() { return g_epoll; }
+void Epoll::makeLocal() { g_epoll = this; }
+
+/*
+** function: init
+**
+** create epoll instance
+**  - edge_triggered: register all fds with EPOLLET
+**  - use_uring: use io_uring instead (always level triggered), epoll is
+**    used if io_uring is not available (old kernel or not allowed)
+*/
+
+void Epoll::init(bool edge_triggered, bool use_uring) {
+  if (use_uring && uring_.init(IO_URING_ENTRIES) == 0) {
+    use_uring_ = true;
+    return;
+  }
+  fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (fd_ == -1) {
+    throw std::runtime_error("webserv: Epoll: cannot create epoll instance");
+  }
+  edge_triggered_ = edge_triggered;
+}
+
+/*
+** function: watch
+**
+** register fd to epoll instance with events
+**    - does nothing if fd is already registered with same events
+**    - fd closed after registration is removed from epoll by kernel,
+**      so fall back to EPOLL_CTL_ADD if EPOLL_CTL_MOD says ENOENT
+**    - EEXIST on EPOLL_CTL_ADD means the table is stale, so modify instead
+**    - returns -1 and errno is EPERM if fd is not pollable (regular file)
+*/
+
+int Epoll::watch(int fd, uint32_t events, uint64_t data) {
+  struct epoll_event ev;
+
+  if (fd < 0) {
+    errno = EBADF;
+    return -1;
+  }
+  if (static_cast<size_t>(fd) >= registered_.size()) {
+    registered_.resize(fd + 1, 0);
+  }
+  if (use_uring_) {
+    if (static_cast<size_t>(fd) >= armed_.size()) {
+      armed_.resize(registered_.size(), 0);
+      data_.resize(registered_.size(), 0);
+      seq_.resize(registered_.size(), 0);
+    }
+    if (registered_[fd] == events && data_[fd] == data) {
+      return 0;
+    }
+    cancelPoll(fd);  // armed again with new events after it is removed
+    registered_[fd] = events;
+    data_[fd] = data;
+    changed_.push_back(fd);
+    return 0;
+  }
+  if (edge_triggered_) {
+    events |= EPOLLET;
+  }
+  if (registered_[fd] == events) {
+    return 0;
+  }
+
+  ev.events = events;
+  ev.data.u64 = data;
+  if (registered_[fd] != 0) {
+    if (epoll_ctl(fd_, EPOLL_CTL_MOD, fd, &ev) == 0) {
+      registered_[fd] = events;
+      return 0;
+    } else if (errno != ENOENT) {
+      return -1;
+    }
+  }
+  if (epoll_ctl(fd_, EPOLL_CTL_ADD, fd, &ev) == -1 &&
+      (errno != EEXIST || epoll_ctl(fd_, EPOLL_CTL_MOD, fd, &ev) == -1)) {
+    registered_[fd] = 0;
+    return -1;
+  }
+  registered_[fd] = events;
+  return 0;
+}
+
+/*
+** function: unwatch
+**
+** remove fd from epoll instance
+**    - error is ignored because fd may be already closed
+**    - poll of io_uring not removed now is removed at next wait
+*/
+
+void Epoll::unwatch(int fd) {
+  if (fd < 0 || static_cast<size_t>(fd) >= registered_.size() ||
+      registered_[fd] == 0) {
+    return;
+  } else if (use_uring_) {
+    cancelPoll(fd);
+  } else {
+    epoll_ctl(fd_, EPOLL_CTL_DEL, fd, NULL);
+  }
+  registered_[fd] = 0;
+}
+
+/*
+** function: getPollData
+**
+** returns user_data of poll of fd now (sequence number is 31 bits, not to
+** be taken as URING_OP_FLAG)
+*/
+
+uint64_t Epoll::getPollData(int fd) const {
+  return (static_cast<uint64_t>(seq_[fd] & 0x7fffffff) << 32) | fd;
+}
+
+/*
+** function: cancelPoll
+**
+** queue removal of poll request of fd armed in io_uring
+**    - poll keeps the file open even if fd is closed, so it must be removed
+**      before fd number is reused (removal is submitted before new polls)
+**    - completion of poll removed is ignored by its old sequence number
+**    - returns -1 if submission queue is still full after it is submitted
+**      (poll is kept armed and removal is tried again at next wait)
+*/
+
+int Epoll::cancelPoll(int fd) {
+  if (armed_[fd] == 0) {
+    return 0;
+  }
+  struct io_uring_sqe* sqe = uring_.getSqe();
+  if (sqe == NULL) {
+    cancels_.push_back(fd);
+    return -1;
+  }
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = getPollData(fd);
+  sqe->user_data = URING_CANCEL_DATA;
+  armed_[fd] = 0;
+  ++seq_[fd];
+  return 0;
+}
+
+/*
+** function: prepareOp
+**
+** returns entry of submission queue for op (or NULL if io_uring is not
+** used or queue is full), op is pending from now
+*/
+
+struct io_uring_sqe* Epoll::prepareOp(int opcode, int fd, UringOp* op) {
+  if (!use_uring_) {
+    return NULL;
+  }
+  struct io_uring_sqe* sqe = uring_.getSqe();
+  if (sqe == NULL) {
+    return NULL;
+  }
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = URING_OP_FLAG | reinterpret_cast<uintptr_t>(op);
+  op->opcode = opcode;
+  op->pending = true;
+  op->done = false;
+  return sqe;
+}
+
+/*
+** function: submitRecv / submitSend / submitRead
+**
+** queue recv, sendmsg of op->iov or readv to op->iov at offset
+** (submitted with next wait, see waitUring)
+*/
+
+int Epoll::submitRecv(int fd, char* buf, size_t len, UringOp* op) {
+  struct io_uring_sqe* sqe = prepareOp(IORING_OP_RECV, fd, op);
+
+  if (sqe == NULL) {
+    return -1;
+  }
+  sqe->addr = reinterpret_cast<uintptr_t>(buf);
+  sqe->len = len;
+  return 0;
+}
+
+int Epoll::submitSend(int fd, int n_iov, UringOp* op) {
+  struct io_uring_sqe* sqe = prepareOp(IORING_OP_SENDMSG, fd, op);
+
+  if (sqe == NULL) {
+    return -1;
+  }
+  memset(&op->msg, 0, sizeof(op->msg));
+  op->msg.msg_iov = op->iov;
+  op->msg.msg_iovlen = n_iov;
+  sqe->addr = reinterpret_cast<uintptr_t>(&op->msg);
+  sqe->len = 1;
+  return 0;
+}
+
+int Epoll::submitRead(int fd, off_t offset, int n_iov, UringOp* op) {
+  struct io_uring_sqe* sqe = prepareOp(IORING_OP_READV, fd, op);
+
+  if (sqe == NULL) {
+    return -1;
+  }
+  sqe->addr = reinterpret_cast<uintptr_t>(op->iov);
+  sqe->len = n_iov;
+  sqe->off = offset;
+  return 0;
+}
+
+/*
+** function: wait
+**
+** wait for events on registered fds
+**    - EINTR is not an error (returns 0)
+*/
+
+int Epoll::wait(struct epoll_event* events, int max_events, int timeout_ms) {
+  if (use_uring_) {
+    return waitUring(events, max_events, timeout_ms);
+  }
+  int n = epoll_wait(fd_, events, max_events, timeout_ms);
+  if (n == -1 && errno == EINTR) {
+    return 0;
+  }
+  return n;
+}
+
+/*
+** function: waitUring
+**
+** arm polls of fds changed or fired since last wait, submit them with
+** removals queued and wait for events, in one system call
+**    - user_data of poll is its sequence number and fd, so that events of
+**      poll removed (or of old fd) are ignored
+**    - completion of UringOp is told as EPOLLIN with key of op (result is
+**      stored to op)
+**    - poll completed with error is told as EPOLLERR (I/O on fd fails)
+**    - completions over max_events are left for next wait
+**    - removals or polls not queued as submission queue is full are left
+**      for next wait (completions are read first to make room)
+*/
+
+int Epoll::waitUring(struct epoll_event* events, int max_events,
+                     int timeout_ms) {
+  std::vector<int> cancels;
+  std::vector<int> changed;
+
+  cancels.swap(cancels_);
+  for (size_t i = 0; i < cancels.size(); ++i) {
+    if (armed_[cancels[i]] != 0 && cancelPoll(cancels[i]) == 0) {
+      changed_.push_back(cancels[i]);  // armed again if still watched
+    }
+  }
+  changed.swap(changed_);
+  for (size_t i = 0; i < changed.size(); ++i) {
+    int fd = changed[i];
+    if (registered_[fd] == 0 || armed_[fd] != 0) {
+      continue;  // not watched, or armed (listed twice or not removed)
+    }
+    struct io_uring_sqe* sqe = uring_.getSqe();
+    if (sqe == NULL) {
+      changed_.assign(changed.begin() + i, changed.end());
+      break;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = registered_[fd];
+    sqe->user_data = getPollData(fd);
+    armed_[fd] = registered_[fd];
+  }
+
+  if (uring_.enter(timeout_ms == 0 ? 0 : 1, timeout_ms) == -1) {
+    return -1;
+  }
+  int n = 0;
+  struct io_uring_cqe* cqe;
+  while (n < max_events && (cqe = uring_.peekCqe()) != NULL) {
+    uint64_t user_data = cqe->user_data;
+    int res = cqe->res;
+    uring_.seenCqe();
+    if (user_data == URING_CANCEL_DATA) {
+      continue;
+    } else if ((user_data & URING_OP_FLAG) != 0) {
+      UringOp* op = reinterpret_cast<UringOp*>(
+          static_cast<uintptr_t>(user_data & ~URING_OP_FLAG));
+      op->pending = false;
+      op->done = true;
+      op->result = res;
+      events[n].events = EPOLLIN;
+      events[n].data.u64 = op->key;
+      ++n;
+      continue;
+    }
+    int fd = static_cast<int>(user_data & 0xffffffff);
+    if (static_cast<size_t>(fd) >= armed_.size() ||
+        user_data != getPollData(fd) || armed_[fd] == 0) {
+      continue;
+    }
+    armed_[fd] = 0;
+    ++seq_[fd];
+    if (registered_[fd] == 0) {
+      continue;  // fired before its removal could be queued
+    }
+    changed_.push_back(fd);  // armed again if still watched
+    events[n].events = res < 0 ? EPOLLERR : static_cast<uint32_t>(res);
+    events[n].data.u64 = data_[fd];
+    ++n;
+  }
+  return n;
+}
@@ -0,0 +1,111 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Epoll.hpp                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/02 10:11:12 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/28 18:40:00 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef EPOLL_HPP
+#define EPOLL_HPP
+
+#include <stdint.h>      // uint32_t
+#include <sys/epoll.h>   // epoll_event
+#include <sys/socket.h>  // msghdr
+#include <sys/uio.h>     // iovec
+
+#include <vector>
+
+#include "Uring.hpp"
+#include "config.hpp"
+
+// I/O submitted to io_uring (see Epoll::submitRecv)
+//    - owner must keep it (and buffers) until done is set by Epoll::wait,
+//      which tells it as EPOLLIN event with key
+struct UringOp {
+  int key;                          // key told with completion
+  int opcode;                       // IORING_OP_XXX submitted last
+  bool pending;                     // submitted and not completed yet
+  bool done;                        // completed and result not taken yet
+  int result;                       // result of I/O (-errno if failed)
+  struct iovec iov[IOBUF_IOV_MAX];  // buffers of SENDMSG and READV
+  struct msghdr msg;                // message of SENDMSG
+};
+
+/*
+** wrapper of epoll instance
+**
+** keeps which events are registered for each fd so that the caller only has
+** to say "watch this fd for these events" and the wrapper decides whether
+** EPOLL_CTL_ADD or EPOLL_CTL_MOD (or nothing) is needed
+**
+** io_uring may be used instead of epoll (see init). then fds are watched
+** by one-shot poll requests of io_uring, which are armed again after each
+** event (so it is level triggered). changes of watching are not system
+** calls but only queued, and submitted with the wait of next loop in one
+** system call.
+**
+** with io_uring, recv and send of sockets and read of files can also be
+** submitted as UringOp, so that they are done by kernel without polling
+** and their completions are waited for together with the polls.
+*/
+
+class Epoll {
+ private:
+  int fd_;                           // fd of epoll instance
+  bool edge_triggered_;              // add EPOLLET to all registrations
+  std::vector<uint32_t> registered_;  // registered events indexed by fd
+  Uring uring_;                      // io_uring instance (if used)
+  bool use_uring_;                   // fds are polled by uring_
+  std::vector<uint32_t> armed_;      // events of poll in uring_ by fd
+  std::vector<uint64_t> data_;       // data of registration by fd
+  std::vector<uint32_t> seq_;        // count of poll requests by fd
+  std::vector<int> changed_;         // fds whose poll may be armed again
+  std::vector<int> cancels_;         // fds whose poll removal is not queued
+
+  // do not allow copy and assignation
+  Epoll(const Epoll& ref);
+  Epoll& operator=(const Epoll& ref);
+
+  uint64_t getPollData(int fd) const;
+  int cancelPoll(int fd);
+  struct io_uring_sqe* prepareOp(int opcode, int fd, UringOp* op);
+  int waitUring(struct epoll_event* events, int max_events, int timeout_ms);
+
+ public:
+  Epoll();
+  ~Epoll();
+
+  // getter
+  int getFd() const;
+  bool isEdgeTriggered() const;
+  bool isUring() const;
+
+  // epoll of worker running in this thread (NULL if none, see makeLocal)
+  static Epoll* getLocal();
+  void makeLocal();
+
+  // function to init an epoll instance (or io_uring instance if use_uring)
+  void init(bool edge_triggered, bool use_uring);
+
+  // start or change watching fd (returns -1 if error)
+  int watch(int fd, uint32_t events, uint64_t data);
+
+  // stop watching fd
+  void unwatch(int fd);
+
+  // submit I/O to io_uring (returns -1 if not submitted, do it by system
+  // call then): recv to buf, sendmsg or readv at offset of op->iov
+  int submitRecv(int fd, char* buf, size_t len, UringOp* op);
+  int submitSend(int fd, int n_iov, UringOp* op);
+  int submitRead(int fd, off_t offset, int n_iov, UringOp* op);
+
+  // wait for events (returns number of events or -1 if error)
+  int wait(struct epoll_event* events, int max_events, int timeout_ms);
+};
+
+#endif /* EPOLL_HPP */
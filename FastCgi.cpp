@@ -0,0 +1,175 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   FastCgi.cpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/19 10:31:27 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/20 16:37:21 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "FastCgi.hpp"
+
+/*
+** function: parseFcgiHeader
+**
+** read header of a record (numbers are in big endian)
+*/
+
+int parseFcgiHeader(const char* data, FcgiHeader* header) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+
+  if (p[0] != FCGI_VERSION_1) {
+    return -1;
+  }
+  header->type = p[1];
+  header->request_id = (p[2] << 8) | p[3];
+  header->content_length = (p[4] << 8) | p[5];
+  header->padding_length = p[6];
+  return 0;
+}
+
+/*
+** function: appendFcgiHeader
+**
+** append header of a record without padding
+*/
+
+static void appendFcgiHeader(std::string* out, int type, size_t len) {
+  char header[FCGI_HEADER_LEN];
+
+  header[0] = FCGI_VERSION_1;
+  header[1] = static_cast<char>(type);
+  header[2] = static_cast<char>((FCGI_REQUEST_ID >> 8) & 0xff);
+  header[3] = static_cast<char>(FCGI_REQUEST_ID & 0xff);
+  header[4] = static_cast<char>((len >> 8) & 0xff);
+  header[5] = static_cast<char>(len & 0xff);
+  header[6] = 0;  // padding length
+  header[7] = 0;  // reserved
+  out->append(header, FCGI_HEADER_LEN);
+}
+
+/*
+** function: appendFcgiRecord
+*/
+
+void appendFcgiRecord(std::string* out, int type, const char* data,
+                      size_t len) {
+  do {
+    size_t content_len = len < FCGI_CONTENT_MAX ? len : FCGI_CONTENT_MAX;
+    appendFcgiHeader(out, type, content_len);
+    out->append(data, content_len);
+    data += content_len;
+    len -= content_len;
+  } while (len > 0);
+}
+
+/*
+** function: appendFcgiBeginRequest
+*/
+
+void appendFcgiBeginRequest(std::string* out, int role, int flags) {
+  char body[8] = {0};
+
+  body[0] = static_cast<char>((role >> 8) & 0xff);
+  body[1] = static_cast<char>(role & 0xff);
+  body[2] = static_cast<char>(flags);
+  appendFcgiRecord(out, FCGI_BEGIN_REQUEST, body, sizeof(body));
+}
+
+/*
+** function: appendFcgiEndRequest
+*/
+
+void appendFcgiEndRequest(std::string* out, int app_status,
+                          int protocol_status) {
+  char body[8] = {0};
+
+  body[0] = static_cast<char>((app_status >> 24) & 0xff);
+  body[1] = static_cast<char>((app_status >> 16) & 0xff);
+  body[2] = static_cast<char>((app_status >> 8) & 0xff);
+  body[3] = static_cast<char>(app_status & 0xff);
+  body[4] = static_cast<char>(protocol_status);
+  appendFcgiRecord(out, FCGI_END_REQUEST, body, sizeof(body));
+}
+
+/*
+** function: appendFcgiLength
+**
+** append length of name or value of a pair
+**    - 1 byte if less than 128, otherwise 4 bytes with the top bit set
+*/
+
+static void appendFcgiLength(std::string* out, size_t len) {
+  if (len < 128) {
+    *out += static_cast<char>(len);
+    return;
+  }
+  *out += static_cast<char>(((len >> 24) & 0x7f) | 0x80);
+  *out += static_cast<char>((len >> 16) & 0xff);
+  *out += static_cast<char>((len >> 8) & 0xff);
+  *out += static_cast<char>(len & 0xff);
+}
+
+/*
+** function: appendFcgiParam
+*/
+
+void appendFcgiParam(std::string* params, const char* name, size_t name_len,
+                     const char* value, size_t value_len) {
+  appendFcgiLength(params, name_len);
+  appendFcgiLength(params, value_len);
+  params->append(name, name_len);
+  params->append(value, value_len);
+}
+
+/*
+** function: parseFcgiLength
+**
+** read length of name or value at *pos (returns -1 if broken)
+*/
+
+static int parseFcgiLength(const std::string& params, size_t* pos,
+                           size_t* len) {
+  const unsigned char* p =
+      reinterpret_cast<const unsigned char*>(params.data()) + *pos;
+
+  if (*pos >= params.size()) {
+    return -1;
+  } else if ((p[0] & 0x80) == 0) {
+    *len = p[0];
+    *pos += 1;
+    return 0;
+  } else if (*pos + 4 > params.size()) {
+    return -1;
+  }
+  *len = (static_cast<size_t>(p[0] & 0x7f) << 24) | (p[1] << 16) |
+         (p[2] << 8) | p[3];
+  *pos += 4;
+  return 0;
+}
+
+/*
+** function: parseFcgiParams
+*/
+
+int parseFcgiParams(const std::string& params,
+                    std::map<std::string, std::string>* out) {
+  size_t pos = 0;
+
+  while (pos < params.size()) {
+    size_t name_len;
+    size_t value_len;
+    if (parseFcgiLength(params, &pos, &name_len) == -1 ||
+        parseFcgiLength(params, &pos, &value_len) == -1 ||
+        params.size() - pos < name_len + value_len) {
+      return -1;
+    }
+    (*out)[params.substr(pos, name_len)] =
+        params.substr(pos + name_len, value_len);
+    pos += name_len + value_len;
+  }
+  return 0;
+}
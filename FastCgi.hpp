@@ -0,0 +1,79 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   FastCgi.hpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/19 10:31:27 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/20 16:37:21 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef FASTCGI_HPP
+#define FASTCGI_HPP
+
+#include <stddef.h>  // size_t
+
+#include <map>
+#include <string>
+
+/*
+** header file for records of FastCGI protocol
+**
+** server and cgi worker exchange records on a connected unix socket.
+** one request is processed at a time on a connection (FCGI_REQUEST_ID),
+** and connection is kept for next request (FCGI_KEEP_CONN).
+*/
+
+#define FCGI_VERSION_1 1
+#define FCGI_HEADER_LEN 8       // bytes of header of a record
+#define FCGI_CONTENT_MAX 65535  // max content length of a record
+#define FCGI_REQUEST_ID 1       // id of request (no multiplexing)
+
+// type of record
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_ABORT_REQUEST 2
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+
+// role and flags of FCGI_BEGIN_REQUEST
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+
+// protocol status of FCGI_END_REQUEST
+#define FCGI_REQUEST_COMPLETE 0
+
+// header of a record
+struct FcgiHeader {
+  int type;
+  int request_id;
+  size_t content_length;
+  size_t padding_length;
+};
+
+// parse header of a record (returns -1 if version is not supported)
+int parseFcgiHeader(const char* data, FcgiHeader* header);
+
+// append records of type with content (split by FCGI_CONTENT_MAX)
+// (an empty record is appended if len is 0, it ends stream of type)
+void appendFcgiRecord(std::string* out, int type, const char* data,
+                      size_t len);
+
+// append FCGI_BEGIN_REQUEST or FCGI_END_REQUEST record
+void appendFcgiBeginRequest(std::string* out, int role, int flags);
+void appendFcgiEndRequest(std::string* out, int app_status,
+                          int protocol_status);
+
+// append a name-value pair to content of FCGI_PARAMS
+void appendFcgiParam(std::string* params, const char* name, size_t name_len,
+                     const char* value, size_t value_len);
+
+// parse content of FCGI_PARAMS (returns -1 if broken)
+int parseFcgiParams(const std::string& params,
+                    std::map<std::string, std::string>* out);
+
+#endif /* FASTCGI_HPP */
@@ -0,0 +1,493 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   FileCache.cpp                                      :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/11 20:36:52 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/27 15:12:40 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "FileCache.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>  // snprintf
+#include <time.h>
+#include <unistd.h>
+
+#include "Deflater.hpp"
+
+/*
+** constructor
+**
+** only one instance (getInstance) is used by all workers
+*/
+
+FileCache::FileCache() : memory_(0) { pthread_mutex_init(&mutex_, NULL); }
+
+/*
+** destructor
+**
+** close all files cached
+*/
+
+FileCache::~FileCache() {
+  for (std::list<Entry*>::iterator itr = lru_.begin(); itr != lru_.end();
+       ++itr) {
+    destroy(*itr);
+  }
+  pthread_mutex_destroy(&mutex_);
+}
+
+/*
+** function: getInstance
+**
+** returns the cache shared by all workers
+** (must be called once before starting workers)
+*/
+
+FileCache& FileCache::getInstance() {
+  static FileCache instance;
+  return instance;
+}
+
+/*
+** function: acquire
+**
+** returns entry of regular file at path with its reference count increased
+**    - cached entry is returned without any system call while it is valid
+**    - errno is ENOENT if file not found, EACCES if not a regular file
+**    - if !wait, returns NULL with errno EWOULDBLOCK instead of stat or open
+**      (to be called again with wait by FilePool)
+**    - stat and open are done without lock (not to block other workers)
+*/
+
+FileCache::Entry* FileCache::acquire(const std::string& path, time_t now,
+                                     bool wait) {
+  Entry* entry = NULL;
+
+  pthread_mutex_lock(&mutex_);
+  std::map<std::string, Entry*>::iterator itr = map_.find(path);
+  if (itr != map_.end() &&
+      now - itr->second->validated < FILE_CACHE_VALID_SEC) {
+    entry = itr->second;
+    lru_.splice(lru_.begin(), lru_, entry->lru_itr);  // most recently used
+    ++entry->ref_count;
+    pthread_mutex_unlock(&mutex_);
+    return entry;
+  } else if (!wait) {
+    pthread_mutex_unlock(&mutex_);
+    errno = EWOULDBLOCK;
+    return NULL;
+  }
+
+  // check if cached file is changed (kept by reference while checking)
+  if (itr != map_.end()) {
+    entry = itr->second;
+    ++entry->ref_count;
+    pthread_mutex_unlock(&mutex_);
+    bool changed = isChanged(entry);
+    pthread_mutex_lock(&mutex_);
+    if (!changed && entry->cached) {
+      entry->validated = now;
+      lru_.splice(lru_.begin(), lru_, entry->lru_itr);
+      pthread_mutex_unlock(&mutex_);
+      return entry;
+    } else if (entry->cached) {
+      remove(entry);
+    }
+    pthread_mutex_unlock(&mutex_);
+    release(entry);
+  } else {
+    pthread_mutex_unlock(&mutex_);
+  }
+
+  // open file (entry opened by other thread at the same time is used)
+  entry = open(path, now);
+  if (entry == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&mutex_);
+  itr = map_.find(path);
+  if (itr != map_.end()) {
+    destroy(entry);
+    entry = itr->second;
+    lru_.splice(lru_.begin(), lru_, entry->lru_itr);
+    ++entry->ref_count;
+  } else {
+    insert(entry);
+    ++entry->ref_count;  // before evict() not to evict this entry
+    evict();
+  }
+  pthread_mutex_unlock(&mutex_);
+  return entry;
+}
+
+/*
+** function: acquireVariant
+**
+** returns entry of file at path, or of its variant compressed in *coding
+** if available (*coding is changed to identity if not)
+**    - file smaller than COMPRESS_MIN_SIZE is not compressed
+**    - if !wait, returns NULL with errno EWOULDBLOCK when I/O is needed
+*/
+
+FileCache::Entry* FileCache::acquireVariant(const std::string& path,
+                                            ContentCoding* coding, time_t now,
+                                            bool wait) {
+  Entry* file = acquire(path, now, wait);
+
+  if (file == NULL || *coding == CODING_IDENTITY) {
+    return file;
+  } else if (file->st.st_size < COMPRESS_MIN_SIZE) {
+    *coding = CODING_IDENTITY;
+    return file;
+  }
+  errno = 0;
+  Entry* variant = acquireCompressed(file, *coding, now, wait);
+  int saved_errno = errno;
+  if (variant != NULL) {
+    release(file);
+    return variant;
+  } else if (saved_errno == EWOULDBLOCK) {
+    release(file);
+    errno = saved_errno;
+    return NULL;
+  }
+  *coding = CODING_IDENTITY;
+  return file;
+}
+
+/*
+** function: getVariantKey
+**
+** key of compressed variant of file ("#<coding>:dev:ino:size:mtime")
+*/
+
+static std::string getVariantKey(const struct stat& st, ContentCoding coding) {
+  char buf[128];
+
+  snprintf(buf, sizeof(buf), "#%d:%lu:%lu:%lld:%lld.%09ld",
+           static_cast<int>(coding), static_cast<unsigned long>(st.st_dev),
+           static_cast<unsigned long>(st.st_ino),
+           static_cast<long long>(st.st_size),
+           static_cast<long long>(st.st_mtim.tv_sec), st.st_mtim.tv_nsec);
+  return buf;
+}
+
+/*
+** function: acquireCompressed
+**
+** returns compressed variant of file with its reference count increased
+**    1. variant compressed in memory (or NULL if known not available)
+**    2. precompressed file path + ".gz" not older than file (gzip only)
+**    3. file compressed now (if not larger than COMPRESS_FILE_MAX)
+** variant not smaller than file is cached as not available (no content),
+** so that each file is compressed only once.
+** if !wait, returns NULL with errno EWOULDBLOCK instead of 2 and 3.
+*/
+
+FileCache::Entry* FileCache::acquireCompressed(const Entry* file,
+                                               ContentCoding coding,
+                                               time_t now, bool wait) {
+  std::string key = getVariantKey(file->st, coding);
+  Entry* entry = NULL;
+
+  pthread_mutex_lock(&mutex_);
+  std::map<std::string, Entry*>::iterator itr = map_.find(key);
+  if (itr != map_.end()) {
+    entry = itr->second;
+    lru_.splice(lru_.begin(), lru_, entry->lru_itr);
+    if (!entry->has_content) {
+      entry = NULL;
+    } else {
+      ++entry->ref_count;
+    }
+    pthread_mutex_unlock(&mutex_);
+    return entry;
+  }
+  pthread_mutex_unlock(&mutex_);
+  if (!wait) {
+    errno = EWOULDBLOCK;
+    return NULL;
+  }
+
+  if (coding == CODING_GZIP) {
+    entry = acquire(file->path + ".gz", now, true);
+    if (entry != NULL) {
+      if (entry->st.st_mtim.tv_sec >= file->st.st_mtim.tv_sec &&
+          entry->st.st_size < file->st.st_size) {
+        return entry;
+      }
+      release(entry);
+    }
+  }
+
+  entry = compress(file, coding, key);  // without lock (may take a while)
+  pthread_mutex_lock(&mutex_);
+  itr = map_.find(key);
+  if (itr != map_.end()) {  // compressed by other worker at the same time
+    destroy(entry);
+    entry = itr->second;
+  } else {
+    insert(entry);
+  }
+  if (!entry->has_content) {
+    entry = NULL;
+  } else {
+    ++entry->ref_count;
+  }
+  evict();
+  pthread_mutex_unlock(&mutex_);
+  return entry;
+}
+
+/*
+** function: retain
+**
+** increase reference count of entry in use
+** (e.g. for each part of a response sending the same file)
+*/
+
+void FileCache::retain(Entry* entry) {
+  pthread_mutex_lock(&mutex_);
+  ++entry->ref_count;
+  pthread_mutex_unlock(&mutex_);
+}
+
+/*
+** function: release
+**
+** decrease reference count (entry removed from cache is closed if unused)
+*/
+
+void FileCache::release(Entry* entry) {
+  pthread_mutex_lock(&mutex_);
+  if (--entry->ref_count == 0 && !entry->cached) {
+    destroy(entry);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+/*
+** function: invalidate
+**
+** remove entry of path from cache
+*/
+
+void FileCache::invalidate(const std::string& path) {
+  pthread_mutex_lock(&mutex_);
+  std::map<std::string, Entry*>::iterator itr = map_.find(path);
+  if (itr != map_.end()) {
+    remove(itr->second);
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+/*
+** function: setValidators
+**
+** make ETag and Last-Modified of file from its stat
+** (ETag is different if inode, size or mtime is changed)
+*/
+
+static void setValidators(FileCache::Entry* entry) {
+  char buf[64];
+  struct tm tm;
+
+  snprintf(buf, sizeof(buf), "\"%lx-%llx-%llx\"",
+           static_cast<unsigned long>(entry->st.st_ino),
+           static_cast<unsigned long long>(entry->st.st_size),
+           static_cast<unsigned long long>(entry->st.st_mtim.tv_sec));
+  entry->etag = buf;
+  gmtime_r(&entry->st.st_mtim.tv_sec, &tm);
+  strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  entry->last_modified = buf;
+}
+
+/*
+** function: open
+**
+** open file and create new entry (content is read if small enough)
+*/
+
+FileCache::Entry* FileCache::open(const std::string& path, time_t now) {
+  Entry* entry = new Entry;
+
+  entry->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (entry->fd == -1) {
+    delete entry;
+    return NULL;
+  }
+  if (fstat(entry->fd, &entry->st) == -1 || !S_ISREG(entry->st.st_mode)) {
+    ::close(entry->fd);
+    delete entry;
+    errno = EACCES;
+    return NULL;
+  }
+  entry->key = path;
+  entry->path = path;
+  setValidators(entry);
+  entry->has_content = false;
+  entry->validated = now;
+  entry->ref_count = 0;
+  entry->cached = true;
+
+  // read content of small file
+  if (entry->st.st_size <= FILE_CACHE_CONTENT_MAX) {
+    entry->content.resize(entry->st.st_size);
+    size_t n_read = 0;
+    while (n_read < entry->content.size()) {
+      ssize_t n = pread(entry->fd, &entry->content[n_read],
+                        entry->content.size() - n_read, n_read);
+      if (n <= 0) {
+        break;
+      }
+      n_read += n;
+    }
+    if (n_read == entry->content.size()) {
+      entry->has_content = true;
+    } else {
+      entry->content.clear();  // changed while reading, use sendfile
+    }
+  }
+  return entry;
+}
+
+/*
+** function: compress
+**
+** create entry of file compressed in memory
+** (entry without content if compression failed or made it not smaller)
+*/
+
+FileCache::Entry* FileCache::compress(const Entry* file, ContentCoding coding,
+                                      const std::string& key) {
+  Entry* entry = new Entry;
+
+  entry->key = key;
+  entry->path = file->path;
+  entry->fd = -1;
+  entry->st = file->st;
+  entry->etag = file->etag;
+  entry->etag.insert(entry->etag.size() - 1,
+                     coding == CODING_GZIP ? "-gzip" : "-deflate");
+  entry->last_modified = file->last_modified;
+  entry->has_content = false;
+  entry->validated = 0;
+  entry->ref_count = 0;
+  entry->cached = true;
+  if (file->st.st_size > COMPRESS_FILE_MAX) {
+    return entry;
+  }
+
+  // read whole file if content is not cached
+  std::string buf;
+  const std::string* content = &file->content;
+  if (!file->has_content) {
+    buf.resize(file->st.st_size);
+    size_t n_read = 0;
+    while (n_read < buf.size()) {
+      ssize_t n = pread(file->fd, &buf[n_read], buf.size() - n_read, n_read);
+      if (n <= 0) {
+        return entry;
+      }
+      n_read += n;
+    }
+    content = &buf;
+  }
+  if (Deflater::compressAll(coding, COMPRESS_FILE_LEVEL, content->data(),
+                            content->size(), &entry->content) == 0 &&
+      entry->content.size() < content->size()) {
+    entry->has_content = true;
+    entry->st.st_size = entry->content.size();
+  } else {
+    entry->content.clear();
+  }
+  return entry;
+}
+
+/*
+** function: insert
+**
+** add entry to cache as most recently used
+*/
+
+void FileCache::insert(Entry* entry) {
+  map_[entry->key] = entry;
+  lru_.push_front(entry);
+  entry->lru_itr = lru_.begin();
+  memory_ += entry->content.size();
+}
+
+/*
+** function: isChanged
+**
+** check if file at path of entry is replaced or modified
+*/
+
+bool FileCache::isChanged(const Entry* entry) const {
+  struct stat st;
+
+  if (stat(entry->path.c_str(), &st) == -1) {
+    return true;
+  }
+  return st.st_ino != entry->st.st_ino || st.st_dev != entry->st.st_dev ||
+         st.st_size != entry->st.st_size ||
+         st.st_mtim.tv_sec != entry->st.st_mtim.tv_sec ||
+         st.st_mtim.tv_nsec != entry->st.st_mtim.tv_nsec;
+}
+
+/*
+** function: remove
+**
+** remove entry from cache (destroyed now if unused, else when released)
+*/
+
+void FileCache::remove(Entry* entry) {
+  map_.erase(entry->key);
+  lru_.erase(entry->lru_itr);
+  memory_ -= entry->content.size();
+  entry->cached = false;
+  if (entry->ref_count == 0) {
+    destroy(entry);
+  }
+}
+
+/*
+** function: destroy
+**
+** close file and free entry
+*/
+
+void FileCache::destroy(Entry* entry) {
+  if (entry->fd != -1) {
+    ::close(entry->fd);
+  }
+  delete entry;
+}
+
+/*
+** function: evict
+**
+** remove least recently used entries not in use
+** while cache exceeds FILE_CACHE_ENTRY_MAX or FILE_CACHE_MEMORY_MAX
+*/
+
+void FileCache::evict() {
+  std::list<Entry*>::iterator itr = lru_.end();
+
+  while (itr != lru_.begin() && (map_.size() > FILE_CACHE_ENTRY_MAX ||
+                                 memory_ > FILE_CACHE_MEMORY_MAX)) {
+    Entry* entry = *--itr;
+    if (entry->ref_count == 0) {
+      itr = lru_.erase(itr);  // next of erased (items after are checked)
+      map_.erase(entry->key);
+      memory_ -= entry->content.size();
+      destroy(entry);
+    }
+  }
+}
@@ -0,0 +1,109 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   FileCache.hpp                                      :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/11 20:14:05 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/27 15:12:40 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef FILECACHE_HPP
+#define FILECACHE_HPP
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "config.hpp"
+#include "http.hpp"
+
+/*
+** cache of opened files shared by all workers
+**
+** keeps fd and stat of files served recently (and content of small files)
+** so that serving a hot file needs no open/fstat/read.
+**    - entry is checked by stat() at most once in FILE_CACHE_VALID_SEC
+**      and reopened if inode, size or mtime changed
+**    - least recently used entries are dropped when number of entries
+**      or memory for contents exceeds the limit
+**    - entries are reference counted, so an entry in use by a session
+**      (e.g. sending by sendfile) is closed after the session releases it
+**    - compressed variant of a file (acquireCompressed) is the entry of
+**      precompressed file (path + ".gz") or content compressed in memory,
+**      which is keyed by coding and identity (inode, size, mtime) of the
+**      file, so that it is never used after the file is changed
+*/
+
+class FileCache {
+ public:
+  struct Entry {
+    std::string key;       // key of cache (path for files)
+    std::string path;      // path of file
+    int fd;                // opened file (read only, -1 for variant)
+    struct stat st;        // stat of file when opened
+    std::string etag;      // value of ETag (made from stat)
+    std::string last_modified;  // value of Last-Modified
+    bool has_content;      // content is cached
+    std::string content;   // content of file (if small enough)
+    time_t validated;      // time last checked file is not changed
+    int ref_count;         // number of users of this entry
+    bool cached;           // false if removed from cache (closed when unused)
+    std::list<Entry*>::iterator lru_itr;  // position in lru_
+  };
+
+ private:
+  pthread_mutex_t mutex_;              // protect all members
+  std::map<std::string, Entry*> map_;  // entries by key
+  std::list<Entry*> lru_;              // entries (most recently used first)
+  size_t memory_;                      // memory used by cached contents
+
+  FileCache();
+  ~FileCache();
+
+  // do not allow copy and assignation
+  FileCache(const FileCache& ref);
+  FileCache& operator=(const FileCache& ref);
+
+  Entry* open(const std::string& path, time_t now);
+  Entry* compress(const Entry* file, ContentCoding coding,
+                  const std::string& key);
+  void insert(Entry* entry);
+  bool isChanged(const Entry* entry) const;
+  void remove(Entry* entry);
+  void destroy(Entry* entry);
+  void evict();
+
+ public:
+  static FileCache& getInstance();
+
+  // returns entry of regular file at path (or NULL and set errno if error)
+  // (if !wait, errno is EWOULDBLOCK if file must be opened or checked)
+  Entry* acquire(const std::string& path, time_t now, bool wait);
+
+  // returns entry of file compressed in coding (NULL if not available)
+  // (file is entry returned by acquire, and result is released as well)
+  Entry* acquireCompressed(const Entry* file, ContentCoding coding,
+                           time_t now, bool wait);
+
+  // returns entry of file or its variant compressed in *coding
+  Entry* acquireVariant(const std::string& path, ContentCoding* coding,
+                        time_t now, bool wait);
+
+  // use entry acquired again (released once more)
+  void retain(Entry* entry);
+
+  // stop using entry returned by acquire
+  void release(Entry* entry);
+
+  // drop entry of path (called when the file is modified by server)
+  void invalidate(const std::string& path);
+};
+
+#endif /* FILECACHE_HPP */
@@ -0,0 +1,242 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   FilePool.cpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/27 13:36:02 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/28 18:10:00 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "FilePool.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>  // rename
+#include <stdlib.h>  // mkostemp
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>  // fchmod, umask, lstat
+#include <sys/uio.h>  // writev
+#include <unistd.h>
+
+#include <stdexcept>
+
+// completions of worker running in this thread
+static __thread FileCompletions* g_file_completions = NULL;
+
+/*
+** constructor / destructor
+**
+** threads live as long as the server (they are never stopped)
+*/
+
+FilePool::FilePool() : create_mode_(0777) {
+  pthread_mutex_init(&mutex_, NULL);
+  pthread_cond_init(&cond_, NULL);
+}
+
+FilePool::~FilePool() {}
+
+/*
+** function: getInstance
+*/
+
+FilePool& FilePool::getInstance() {
+  static FilePool instance;
+  return instance;
+}
+
+/*
+** function: start
+*/
+
+void FilePool::start(int n_threads) {
+  mode_t mask = umask(0);  // (only way to get it)
+
+  umask(mask);
+  create_mode_ = 0777 & ~mask;
+  for (int i = 0; i < n_threads; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, runThread, this) != 0) {
+      throw std::runtime_error("webserv: FilePool: cannot create thread");
+    }
+    pthread_detach(thread);
+    threads_.push_back(thread);
+  }
+}
+
+/*
+** function: submit
+*/
+
+void FilePool::submit(FileJob* job) {
+  pthread_mutex_lock(&mutex_);
+  jobs_.push_back(job);
+  pthread_cond_signal(&cond_);
+  pthread_mutex_unlock(&mutex_);
+}
+
+/*
+** function: runThread
+**
+** take jobs in order and do them
+*/
+
+void* FilePool::runThread(void* arg) {
+  FilePool* pool = static_cast<FilePool*>(arg);
+
+  while (1) {
+    pthread_mutex_lock(&pool->mutex_);
+    while (pool->jobs_.empty()) {
+      pthread_cond_wait(&pool->cond_, &pool->mutex_);
+    }
+    FileJob* job = pool->jobs_.front();
+    pool->jobs_.pop_front();
+    pthread_mutex_unlock(&pool->mutex_);
+    pool->process(job);
+  }
+  return NULL;
+}
+
+/*
+** function: process
+**
+** do I/O of job and tell the worker of it
+**    - file to CREATE is made with unique name from template in path
+**      (existing file is never truncated), set back to path
+**    - CREATE fails with EPERM if new_path exists and is not a regular
+**      file (directory, symlink, device or fifo is not replaced)
+*/
+
+void FilePool::process(FileJob* job) {
+  std::vector<char> name;
+  struct stat st;
+  off_t offset;
+
+  errno = 0;
+  switch (job->type) {
+    case FILE_JOB_OPEN:
+      job->entry = FileCache::getInstance().acquireVariant(
+          job->path, &job->coding, job->now, true);
+      job->result = job->entry == NULL ? -1 : 0;
+      break;
+    case FILE_JOB_CREATE:
+      if (lstat(job->new_path.c_str(), &st) == 0 && !S_ISREG(st.st_mode)) {
+        errno = EPERM;
+        job->fd = -1;
+        job->result = -1;
+        break;
+      }
+      name.assign(job->path.c_str(), job->path.c_str() + job->path.size() + 1);
+      job->fd = mkostemp(&name[0], O_CLOEXEC);
+      if (job->fd == -1) {
+        job->result = -1;
+        break;
+      }
+      job->path = &name[0];
+      fchmod(job->fd, create_mode_);  // (mkostemp creates it as 0600)
+      if (job->size > 0) {  // (not supported by some file systems)
+        fallocate(job->fd, FALLOC_FL_KEEP_SIZE, 0, job->size);
+      }
+      // fall through - data is written with open
+    case FILE_JOB_WRITE:
+      job->result = job->n_iov > 0 ? writev(job->fd, job->iov, job->n_iov) : 0;
+      if (job->result == -1 || !job->commit ||
+          static_cast<size_t>(job->result) != job->len) {
+        break;
+      }
+      job->type = FILE_JOB_RENAME;
+      // fall through - file is renamed after all data is written
+    case FILE_JOB_RENAME:
+      close(job->fd);
+      job->result = rename(job->path.c_str(), job->new_path.c_str());
+      break;
+    case FILE_JOB_SENDFILE:
+      offset = job->offset;
+      job->result = sendfile(job->sock_fd, job->fd, &offset, job->len);
+      break;
+  }
+  job->error = errno;
+  job->completions->push(job);
+}
+
+/*
+** FileCompletions: constructor / destructor
+*/
+
+FileCompletions::FileCompletions() : fd_(-1) {
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+FileCompletions::~FileCompletions() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  pthread_mutex_destroy(&mutex_);
+}
+
+/*
+** function: getLocal
+**
+** (created for each worker thread at first use)
+*/
+
+FileCompletions& FileCompletions::getLocal() {
+  if (g_file_completions == NULL) {
+    g_file_completions = new FileCompletions;
+  }
+  return *g_file_completions;
+}
+
+/*
+** function: init
+*/
+
+void FileCompletions::init() {
+  fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd_ == -1) {
+    throw std::runtime_error("webserv: FileCompletions: cannot create eventfd");
+  }
+}
+
+int FileCompletions::getFd() const { return fd_; }
+
+/*
+** function: push
+**
+** eventfd is written only by the first job (worker takes all at once)
+*/
+
+void FileCompletions::push(FileJob* job) {
+  uint64_t one = 1;
+
+  pthread_mutex_lock(&mutex_);
+  bool was_empty = jobs_.empty();
+  jobs_.push_back(job);
+  pthread_mutex_unlock(&mutex_);
+  if (was_empty && write(fd_, &one, sizeof(one)) == -1) {
+    return;  // (counter cannot overflow, it is reset by each popAll)
+  }
+}
+
+/*
+** function: popAll
+**
+** eventfd is reset before taking jobs (job done after that wakes again)
+*/
+
+void FileCompletions::popAll(std::vector<FileJob*>* jobs) {
+  uint64_t count;
+
+  jobs->clear();
+  if (read(fd_, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+    return;
+  }
+  pthread_mutex_lock(&mutex_);
+  jobs->swap(jobs_);
+  pthread_mutex_unlock(&mutex_);
+}
@@ -0,0 +1,140 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   FilePool.hpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/27 13:36:02 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/28 16:31:00 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef FILEPOOL_HPP
+#define FILEPOOL_HPP
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>  // iovec
+#include <time.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "FileCache.hpp"
+#include "config.hpp"
+#include "http.hpp"
+
+class FileCompletions;
+
+// kind of blocking file I/O done by FilePool
+enum FileJobType {
+  FILE_JOB_OPEN,     // acquire file (or its variant) from FileCache
+  FILE_JOB_CREATE,   // create file to write, and write data to it
+  FILE_JOB_WRITE,    // write data to file
+  FILE_JOB_RENAME,   // close file written and rename it to new_path
+  FILE_JOB_SENDFILE  // send region of file to socket (not in page cache)
+};
+
+// a request of file I/O and its result
+// (owned by session, which is kept until it is done even if timed out)
+//    - CREATE or WRITE with commit goes on to RENAME when all data is
+//      written (type is changed to RENAME then)
+struct FileJob {
+  FileJobType type;
+  int key;                       // session to resume when done
+  FileCompletions* completions;  // where to tell completion (its worker)
+  bool finished;                 // completion is taken by worker
+  std::string path;              // file to open (OPEN, RENAME), or template
+                                 // replaced by name of file created (CREATE)
+  std::string new_path;          // path to rename file to (RENAME)
+  off_t size;                    // bytes to preallocate (CREATE, 0 if unknown)
+  ContentCoding coding;          // coding accepted, and used for result (OPEN)
+  time_t now;                    // time of request (OPEN)
+  int fd;                        // file to write or send, or opened (CREATE)
+  int sock_fd;                   // socket to send to (SENDFILE)
+  off_t offset;                  // offset of file to send (SENDFILE)
+  struct iovec iov[FILE_WRITE_IOV_MAX];  // data to write (CREATE, WRITE)
+  int n_iov;                     // number of iov filled
+  size_t len;                    // bytes to write or send (0 if none)
+  bool commit;                   // rename file after writing all data
+  FileCache::Entry* entry;       // entry acquired (OPEN)
+  ssize_t result;                // returned value of I/O (-1 if failed)
+  int error;                     // errno if failed
+};
+
+/*
+** threads doing blocking file I/O for all workers
+**
+** regular files are always "ready" for epoll, and read, write or open of
+** them waits for disk in the event loop (stopping all sessions of the
+** worker). so such I/O is done by these threads instead, and worker is
+** told by FileCompletions when it is done.
+*/
+
+class FilePool {
+ private:
+  pthread_mutex_t mutex_;        // protect jobs_
+  pthread_cond_t cond_;          // signaled when job is added
+  std::deque<FileJob*> jobs_;    // jobs not started yet
+  std::vector<pthread_t> threads_;
+  mode_t create_mode_;           // mode of file created (masked by umask)
+
+  FilePool();
+  ~FilePool();
+
+  // do not allow copy and assignation
+  FilePool(const FilePool& ref);
+  FilePool& operator=(const FilePool& ref);
+
+  static void* runThread(void* arg);
+  void process(FileJob* job);
+
+ public:
+  static FilePool& getInstance();
+
+  // start threads (must be called once before starting workers)
+  void start(int n_threads);
+
+  // request job to be done by a thread
+  void submit(FileJob* job);
+};
+
+/*
+** jobs of FilePool done for one worker
+**
+** eventfd is readable while jobs are done, so that the worker waits for
+** them with its sockets (see Server::run)
+*/
+
+class FileCompletions {
+ private:
+  int fd_;                        // eventfd
+  pthread_mutex_t mutex_;         // protect jobs_
+  std::vector<FileJob*> jobs_;    // jobs done and not popped
+
+  // do not allow copy and assignation
+  FileCompletions(const FileCompletions& ref);
+  FileCompletions& operator=(const FileCompletions& ref);
+
+ public:
+  FileCompletions();
+  ~FileCompletions();
+
+  // returns completions of worker of this thread
+  static FileCompletions& getLocal();
+
+  // create eventfd (throws runtime_error if failed)
+  void init();
+
+  int getFd() const;
+
+  // add job done (called by thread of FilePool)
+  void push(FileJob* job);
+
+  // take all jobs done
+  void popAll(std::vector<FileJob*>* jobs);
+};
+
+#endif /* FILEPOOL_HPP */
@@ -0,0 +1,589 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   HttpRequest.cpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/05 16:30:09 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/22 19:03:27 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "HttpRequest.hpp"
+
+#include <string.h>  // strlen
+
+#include <algorithm>
+#include <cctype>
+
+#include "http.hpp"
+
+/*
+** default constructor
+**
+** ready to parse request from offset 0
+*/
+
+HttpRequest::HttpRequest() { reset(0); }
+
+/*
+** copy constructor
+*/
+
+HttpRequest::HttpRequest(const HttpRequest& ref) { *this = ref; }
+
+/*
+** assignation operator overload
+*/
+
+HttpRequest& HttpRequest::operator=(const HttpRequest& rhs) {
+  if (this == &rhs) {
+    return *this;
+  }
+  state_ = rhs.state_;
+  start_ = rhs.start_;
+  pos_ = rhs.pos_;
+  mark_ = rhs.mark_;
+  method_ = rhs.method_;
+  target_ = rhs.target_;
+  version_minor_ = rhs.version_minor_;
+  headers_ = rhs.headers_;
+  header_size_ = rhs.header_size_;
+  chunked_ = rhs.chunked_;
+  has_length_ = rhs.has_length_;
+  content_length_ = rhs.content_length_;
+  body_remain_ = rhs.body_remain_;
+  body_size_ = rhs.body_size_;
+  body_ = rhs.body_;
+  error_ = rhs.error_;
+  return *this;
+}
+
+/*
+** destructor
+*/
+
+HttpRequest::~HttpRequest() {}
+
+/*
+** getters
+*/
+
+ParseState HttpRequest::getState() const { return state_; }
+int HttpRequest::getError() const { return error_; }
+size_t HttpRequest::getStart() const { return start_; }
+size_t HttpRequest::getEnd() const { return start_ + pos_; }
+HttpRequest::View HttpRequest::getMethod() const { return method_; }
+HttpRequest::View HttpRequest::getTarget() const { return target_; }
+int HttpRequest::getVersionMinor() const { return version_minor_; }
+const std::vector<HttpRequest::Header>& HttpRequest::getHeaders() const {
+  return headers_;
+}
+size_t HttpRequest::getHeaderSize() const { return header_size_; }
+size_t HttpRequest::getContentLength() const { return content_length_; }
+const std::vector<HttpRequest::View>& HttpRequest::getBody() const {
+  return body_;
+}
+size_t HttpRequest::getBodySize() const { return body_size_; }
+
+/*
+** function: reset
+**
+** clear parsed result and start parsing new request from offset start
+*/
+
+void HttpRequest::reset(size_t start) {
+  state_ = PARSE_REQ_START;
+  start_ = start;
+  pos_ = 0;
+  mark_ = 0;
+  method_.off = 0;
+  method_.len = 0;
+  target_.off = 0;
+  target_.len = 0;
+  version_minor_ = 1;
+  headers_.clear();
+  header_size_ = 0;
+  chunked_ = false;
+  has_length_ = false;
+  content_length_ = 0;
+  body_remain_ = 0;
+  body_size_ = 0;
+  body_.clear();
+  error_ = 0;
+}
+
+/*
+** function: isTchar
+**
+** check if c is a character allowed in token (RFC 7230 3.2.6)
+*/
+
+static bool isTchar(unsigned char c) {
+  return std::isalnum(c) || (c != 0 && strchr("!#$%&'*+-.^_`|~", c));
+}
+
+/*
+** function: fail
+**
+** stop parsing with http status
+*/
+
+ParseStatus HttpRequest::fail(int http_status) {
+  error_ = http_status;
+  return PARSE_ERROR;
+}
+
+/*
+** function: parse
+**
+** parse received data in buf from where parsed last time
+**    - request line and headers are parsed byte by byte
+**      (they must be contiguous in buf, see Session::recvReq)
+**    - body is consumed in bulk by parseBody
+**    - returns PARSE_AGAIN until whole request is received
+*/
+
+ParseStatus HttpRequest::parse(const IoBuffer& buf) {
+  ParseStatus ret;
+  size_t len;
+  const char* head = buf.peek(start_, &len);  // request line and headers
+
+  if (error_ != 0) {
+    return PARSE_ERROR;
+  } else if (state_ == PARSE_END) {
+    return PARSE_DONE;
+  }
+
+  while (start_ + pos_ < buf.getEnd()) {
+    if (state_ >= PARSE_BODY) {
+      return parseBody(buf);
+    }
+    if (pos_ >= REQUEST_HEADER_MAX) {
+      return fail(HTTP_431);
+    } else if (pos_ >= len) {
+      return PARSE_AGAIN;  // not contiguous yet
+    }
+
+    unsigned char c = head[pos_];
+    switch (state_) {
+      case PARSE_REQ_START:  // ignore empty lines before request line
+        if (c == '\r' || c == '\n') {
+          break;
+        } else if (!isTchar(c)) {
+          return fail(HTTP_400);
+        }
+        mark_ = pos_;
+        state_ = PARSE_REQ_METHOD;
+        break;
+
+      case PARSE_REQ_METHOD:
+        if (c == ' ') {
+          method_.off = mark_;
+          method_.len = pos_ - mark_;
+          mark_ = pos_ + 1;
+          state_ = PARSE_REQ_TARGET;
+        } else if (!isTchar(c)) {
+          return fail(HTTP_400);
+        }
+        break;
+
+      case PARSE_REQ_TARGET:
+        if (c == ' ') {
+          if (pos_ == mark_) {
+            return fail(HTTP_400);
+          }
+          target_.off = mark_;
+          target_.len = pos_ - mark_;
+          mark_ = pos_ + 1;
+          state_ = PARSE_REQ_VERSION;
+        } else if (c < 0x20 || c == 0x7f) {
+          return fail(HTTP_400);
+        }
+        break;
+
+      case PARSE_REQ_VERSION:  // only "HTTP/1.x" is accepted
+        if (c == '\r' || c == '\n') {
+          if (pos_ - mark_ != 8 || memcmp(head + mark_, "HTTP/", 5) ||
+              !std::isdigit(head[mark_ + 5]) || head[mark_ + 6] != '.' ||
+              !std::isdigit(head[mark_ + 7])) {
+            return fail(HTTP_400);
+          } else if (head[mark_ + 5] != '1') {
+            return fail(HTTP_505);
+          }
+          version_minor_ = head[mark_ + 7] - '0';
+          state_ = (c == '\r') ? PARSE_REQ_LF : PARSE_HEADER_START;
+        } else if (pos_ - mark_ >= 8) {
+          return fail(HTTP_400);
+        }
+        break;
+
+      case PARSE_REQ_LF:
+      case PARSE_HEADER_LF:
+        if (c != '\n') {
+          return fail(HTTP_400);
+        }
+        state_ = PARSE_HEADER_START;
+        break;
+
+      case PARSE_HEADER_START:
+        if (c == '\r') {
+          state_ = PARSE_HEADERS_END_LF;
+          break;
+        } else if (c == '\n') {
+          ++pos_;
+          if ((ret = parseHeadersEnd()) != PARSE_AGAIN) {
+            return ret;
+          }
+          continue;
+        } else if (!isTchar(c)) {  // obs-fold is also rejected here
+          return fail(HTTP_400);
+        }
+        mark_ = pos_;
+        state_ = PARSE_HEADER_NAME;
+        break;
+
+      case PARSE_HEADER_NAME:
+        if (c == ':') {
+          Header header;
+          header.name.off = mark_;
+          header.name.len = pos_ - mark_;
+          headers_.push_back(header);
+          state_ = PARSE_HEADER_OWS;
+        } else if (!isTchar(c)) {
+          return fail(HTTP_400);
+        }
+        break;
+
+      case PARSE_HEADER_OWS:
+        if (c == ' ' || c == '\t') {
+          break;
+        }
+        mark_ = pos_;
+        state_ = PARSE_HEADER_VALUE;
+        continue;  // parse this character again as value
+
+      case PARSE_HEADER_VALUE:
+        if (c == '\r' || c == '\n') {
+          size_t end = pos_;
+          while (end > mark_ &&
+                 (head[end - 1] == ' ' || head[end - 1] == '\t')) {
+            --end;
+          }
+          headers_.back().value.off = mark_;
+          headers_.back().value.len = end - mark_;
+          if ((ret = parseHeaderField(head)) != PARSE_AGAIN) {
+            return ret;
+          }
+          state_ = (c == '\r') ? PARSE_HEADER_LF : PARSE_HEADER_START;
+        } else if ((c < 0x20 && c != '\t') || c == 0x7f) {
+          return fail(HTTP_400);
+        }
+        break;
+
+      case PARSE_HEADERS_END_LF:
+        if (c != '\n') {
+          return fail(HTTP_400);
+        }
+        ++pos_;
+        if ((ret = parseHeadersEnd()) != PARSE_AGAIN) {
+          return ret;
+        }
+        continue;
+
+      default:
+        return fail(HTTP_500);
+    }
+    ++pos_;
+  }
+  return PARSE_AGAIN;
+}
+
+/*
+** function: parseHeaderField
+**
+** interpret header field just parsed if it is needed for parsing body
+*/
+
+ParseStatus HttpRequest::parseHeaderField(const char* head) {
+  const Header& header = headers_.back();
+
+  if (equalsIgnoreCase(head, header.name, "Content-Length")) {
+    size_t value = 0;
+    if (header.value.len == 0) {
+      return fail(HTTP_400);
+    }
+    for (size_t i = 0; i < header.value.len; ++i) {
+      char c = head[header.value.off + i];
+      if (!std::isdigit(c) || value > (static_cast<size_t>(-1) - 9) / 10) {
+        return fail(HTTP_400);
+      }
+      value = value * 10 + (c - '0');
+    }
+    if (has_length_ && value != content_length_) {
+      return fail(HTTP_400);
+    }
+    has_length_ = true;
+    content_length_ = value;
+  } else if (equalsIgnoreCase(head, header.name, "Transfer-Encoding")) {
+    if (!equalsIgnoreCase(head, header.value, "chunked")) {
+      return fail(HTTP_501);
+    }
+    chunked_ = true;
+  }
+  return PARSE_AGAIN;
+}
+
+/*
+** function: parseHeadersEnd
+**
+** decide how to read body after all headers are parsed
+*/
+
+ParseStatus HttpRequest::parseHeadersEnd() {
+  header_size_ = pos_;
+  if (chunked_) {
+    if (has_length_) {
+      return fail(HTTP_400);
+    }
+    body_remain_ = 0;
+    mark_ = pos_;
+    state_ = PARSE_CHUNK_SIZE;
+    return PARSE_AGAIN;
+  } else if (has_length_ && content_length_ > 0) {
+    if (content_length_ > REQUEST_BODY_MAX) {
+      return fail(HTTP_413);
+    }
+    body_remain_ = content_length_;
+    state_ = PARSE_BODY;
+    return PARSE_AGAIN;
+  }
+  state_ = PARSE_END;
+  return PARSE_DONE;
+}
+
+/*
+** function: addBody
+**
+** record body data (merged with previous one if contiguous)
+*/
+
+static void addBody(std::vector<HttpRequest::View>& body, size_t off,
+                    size_t len) {
+  if (!body.empty() && body.back().off + body.back().len == off) {
+    body.back().len += len;
+    return;
+  }
+  HttpRequest::View view;
+  view.off = off;
+  view.len = len;
+  body.push_back(view);
+}
+
+/*
+** function: parseBody
+**
+** parse body of Content-Length or chunked encoding
+**    - data is not copied, only its position is recorded in body_
+**    - trailer fields of chunked encoding are ignored
+*/
+
+ParseStatus HttpRequest::parseBody(const IoBuffer& buf) {
+  while (start_ + pos_ < buf.getEnd()) {
+    size_t len;
+    const char* span = buf.peek(start_ + pos_, &len);  // contiguous data
+    size_t span_start = pos_;
+    while (pos_ < span_start + len) {
+      unsigned char c = span[pos_ - span_start];
+      switch (state_) {
+        case PARSE_BODY:
+        case PARSE_CHUNK_DATA: {
+          size_t n = std::min(span_start + len - pos_, body_remain_);
+          addBody(body_, pos_, n);
+          pos_ += n;
+          body_size_ += n;
+          body_remain_ -= n;
+          if (body_remain_ == 0) {
+            if (state_ == PARSE_BODY) {
+              state_ = PARSE_END;
+              return PARSE_DONE;
+            }
+            state_ = PARSE_CHUNK_DATA_CR;
+          }
+          continue;
+        }
+
+        case PARSE_CHUNK_SIZE:
+          if (std::isxdigit(c)) {
+            if (pos_ - mark_ >= 15) {
+              return fail(HTTP_413);
+            }
+            int digit = std::isdigit(c) ? c - '0' : std::tolower(c) - 'a' + 10;
+            body_remain_ = body_remain_ * 16 + digit;
+            break;
+          } else if (pos_ == mark_) {
+            return fail(HTTP_400);
+          } else if (c == ';' || c == ' ' || c == '\t') {
+            state_ = PARSE_CHUNK_EXT;
+            break;
+          } else if (c == '\r') {
+            state_ = PARSE_CHUNK_SIZE_LF;
+            break;
+          } else if (c != '\n') {
+            return fail(HTTP_400);
+          }
+          state_ = PARSE_CHUNK_SIZE_LF;
+          continue;  // parse this LF as end of chunk size line
+
+        case PARSE_CHUNK_EXT:  // chunk extensions are ignored
+          if (c == '\r' || c == '\n') {
+            state_ = PARSE_CHUNK_SIZE_LF;
+            if (c == '\n') {
+              continue;
+            }
+          }
+          break;
+
+        case PARSE_CHUNK_SIZE_LF:
+          if (c != '\n') {
+            return fail(HTTP_400);
+          } else if (body_size_ + body_remain_ > REQUEST_BODY_MAX) {
+            return fail(HTTP_413);
+          }
+          mark_ = pos_ + 1;
+          state_ = (body_remain_ == 0) ? PARSE_TRAILER_START : PARSE_CHUNK_DATA;
+          break;
+
+        case PARSE_CHUNK_DATA_CR:
+          if (c == '\r') {
+            state_ = PARSE_CHUNK_DATA_LF;
+            break;
+          } else if (c != '\n') {
+            return fail(HTTP_400);
+          }
+          state_ = PARSE_CHUNK_DATA_LF;
+          continue;
+
+        case PARSE_CHUNK_DATA_LF:
+          if (c != '\n') {
+            return fail(HTTP_400);
+          }
+          mark_ = pos_ + 1;
+          state_ = PARSE_CHUNK_SIZE;
+          break;
+
+        case PARSE_TRAILER_START:
+          if (c == '\r') {
+            state_ = PARSE_TRAILER_LF;
+            break;
+          } else if (c == '\n') {
+            ++pos_;
+            state_ = PARSE_END;
+            return PARSE_DONE;
+          }
+          state_ = PARSE_TRAILER;
+          break;
+
+        case PARSE_TRAILER:
+          if (pos_ - mark_ >= REQUEST_HEADER_MAX) {
+            return fail(HTTP_431);
+          } else if (c == '\n') {
+            state_ = PARSE_TRAILER_START;
+          }
+          break;
+
+        case PARSE_TRAILER_LF:
+          if (c != '\n') {
+            return fail(HTTP_400);
+          }
+          ++pos_;
+          state_ = PARSE_END;
+          return PARSE_DONE;
+
+        default:
+          return fail(HTTP_500);
+      }
+      ++pos_;
+    }
+  }
+  return PARSE_AGAIN;
+}
+
+/*
+** function: findHeader
+**
+** returns value of header field named name (case insensitive) or NULL
+*/
+
+const HttpRequest::View* HttpRequest::findHeader(const char* head,
+                                                 const char* name) const {
+  for (std::vector<Header>::const_iterator itr = headers_.begin();
+       itr != headers_.end(); ++itr) {
+    if (equalsIgnoreCase(head, itr->name, name)) {
+      return &itr->value;
+    }
+  }
+  return NULL;
+}
+
+/*
+** utilities for View
+*/
+
+bool HttpRequest::equals(const char* head, const View& view, const char* str) {
+  return view.len == strlen(str) && !memcmp(head + view.off, str, view.len);
+}
+
+bool HttpRequest::equalsIgnoreCase(const char* head, const View& view,
+                                   const char* str) {
+  if (view.len != strlen(str)) {
+    return false;
+  }
+  for (size_t i = 0; i < view.len; ++i) {
+    if (std::tolower(static_cast<unsigned char>(head[view.off + i])) !=
+        std::tolower(static_cast<unsigned char>(str[i]))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string HttpRequest::toString(const char* head, const View& view) {
+  return std::string(head + view.off, view.len);
+}
+
+/*
+** function: hasToken
+**
+** check if comma separated list in view has token (case insensitive)
+** (e.g. "keep-alive, Upgrade" has "upgrade")
+*/
+
+bool HttpRequest::hasToken(const char* head, const View& view,
+                           const char* token) {
+  size_t i = 0;
+
+  while (i < view.len) {
+    // skip separators and find end of element
+    while (i < view.len && (head[view.off + i] == ',' ||
+                            head[view.off + i] == ' ' ||
+                            head[view.off + i] == '\t')) {
+      ++i;
+    }
+    View elem;
+    elem.off = view.off + i;
+    while (i < view.len && head[view.off + i] != ',') {
+      ++i;
+    }
+    elem.len = view.off + i - elem.off;
+    while (elem.len > 0 && (head[elem.off + elem.len - 1] == ' ' ||
+                            head[elem.off + elem.len - 1] == '\t')) {
+      --elem.len;
+    }
+    if (equalsIgnoreCase(head, elem, token)) {
+      return true;
+    }
+  }
+  return false;
+}
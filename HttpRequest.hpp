@@ -0,0 +1,142 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   HttpRequest.hpp                                    :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/05 16:02:44 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/22 19:03:27 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef HTTPREQUEST_HPP
+#define HTTPREQUEST_HPP
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "IoBuffer.hpp"
+#include "config.hpp"
+
+// result of HttpRequest::parse
+enum ParseStatus {
+  PARSE_AGAIN,  // need more data
+  PARSE_DONE,   // whole request (including body) is received
+  PARSE_ERROR   // bad request (http status is in getError())
+};
+
+// state of parser
+enum ParseState {
+  PARSE_REQ_START,
+  PARSE_REQ_METHOD,
+  PARSE_REQ_TARGET,
+  PARSE_REQ_VERSION,
+  PARSE_REQ_LF,
+  PARSE_HEADER_START,
+  PARSE_HEADER_NAME,
+  PARSE_HEADER_OWS,
+  PARSE_HEADER_VALUE,
+  PARSE_HEADER_LF,
+  PARSE_HEADERS_END_LF,
+  PARSE_BODY,
+  PARSE_CHUNK_SIZE,
+  PARSE_CHUNK_EXT,
+  PARSE_CHUNK_SIZE_LF,
+  PARSE_CHUNK_DATA,
+  PARSE_CHUNK_DATA_CR,
+  PARSE_CHUNK_DATA_LF,
+  PARSE_TRAILER_START,
+  PARSE_TRAILER,
+  PARSE_TRAILER_LF,
+  PARSE_END
+};
+
+/*
+** incremental parser of HTTP/1.1 request
+**
+** parse() is called each time data is appended to the receive buffer and
+** continues from where it stopped last time, so no byte is scanned twice.
+** parsed items are not copied but recorded as offset/length (View) from
+** start of the request in the receive buffer, so pointer to the start of
+** request (request line and headers are contiguous there) must be passed
+** to access them. body may not be contiguous (see IoBuffer::peek).
+*/
+
+class HttpRequest {
+ public:
+  // offset and length of a part of receive buffer
+  struct View {
+    size_t off;
+    size_t len;
+  };
+
+  // a header field
+  struct Header {
+    View name;
+    View value;
+  };
+
+ private:
+  ParseState state_;            // current state of parser
+  size_t start_;                // offset of this request in buffer
+  size_t pos_;                  // offset parsed so far (from start_)
+  size_t mark_;                 // offset of token now parsing (from start_)
+  View method_;                 // request method
+  View target_;                 // request target
+  int version_minor_;           // x of HTTP/1.x
+  std::vector<Header> headers_;  // header fields
+  size_t header_size_;          // size of request line and headers
+  bool chunked_;                // Transfer-Encoding: chunked
+  bool has_length_;             // Content-Length is specified
+  size_t content_length_;       // value of Content-Length
+  size_t body_remain_;          // rest of body (or current chunk) to parse
+  size_t body_size_;            // total size of body
+  std::vector<View> body_;      // body (chunk data if chunked)
+  int error_;                   // http status if parse failed
+
+  ParseStatus fail(int http_status);
+  ParseStatus parseHeaderField(const char* head);
+  ParseStatus parseHeadersEnd();
+  ParseStatus parseBody(const IoBuffer& buf);
+
+ public:
+  HttpRequest();
+  HttpRequest(const HttpRequest& ref);
+  HttpRequest& operator=(const HttpRequest& ref);
+  ~HttpRequest();
+
+  // getters
+  ParseState getState() const;
+  int getError() const;
+  size_t getStart() const;
+  size_t getEnd() const;
+  View getMethod() const;
+  View getTarget() const;
+  int getVersionMinor() const;
+  const std::vector<Header>& getHeaders() const;
+  size_t getHeaderSize() const;
+  size_t getContentLength() const;
+  const std::vector<View>& getBody() const;
+  size_t getBodySize() const;
+
+  // start parsing new request at offset start of buffer
+  void reset(size_t start);
+
+  // parse data in buf from where parsed last time
+  ParseStatus parse(const IoBuffer& buf);
+
+  // returns header field named name (case insensitive) or NULL
+  const View* findHeader(const char* head, const char* name) const;
+
+  // utilities for View (head is pointer to start of request)
+  static bool equals(const char* head, const View& view, const char* str);
+  static bool equalsIgnoreCase(const char* head, const View& view,
+                               const char* str);
+  static std::string toString(const char* head, const View& view);
+  static bool hasToken(const char* head, const View& view, const char* token);
+};
+
+#endif /* HTTPREQUEST_HPP */
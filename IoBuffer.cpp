@@ -0,0 +1,423 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   IoBuffer.cpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/13 14:51:07 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/28 18:40:00 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "IoBuffer.hpp"
+
+#include <string.h>  // memcpy
+
+#include <algorithm>
+
+/*
+** free list of blocks (one for each thread, so no lock is needed)
+*/
+
+static __thread IoBlock* g_free_blocks = NULL;
+static __thread size_t g_n_free_blocks = 0;
+
+/*
+** function: allocateBlock
+**
+** take a block from free list (allocate new one only if empty)
+*/
+
+IoBlock* IoBuffer::allocateBlock() {
+  IoBlock* block = g_free_blocks;
+
+  if (block != NULL) {
+    g_free_blocks = block->next;
+    --g_n_free_blocks;
+  } else {
+    block = new IoBlock;
+  }
+  block->next = NULL;
+  block->start = 0;
+  block->end = 0;
+  return block;
+}
+
+/*
+** function: freeBlock
+**
+** return block to free list (free it if free list is full)
+*/
+
+void IoBuffer::freeBlock(IoBlock* block) {
+  if (g_n_free_blocks >= IOBUF_POOL_MAX) {
+    delete block;
+    return;
+  }
+  block->next = g_free_blocks;
+  g_free_blocks = block;
+  ++g_n_free_blocks;
+}
+
+/*
+** default constructor
+**
+** no block is taken until data is written
+*/
+
+IoBuffer::IoBuffer()
+    : head_(NULL), tail_(NULL), write_(NULL), begin_(0), size_(0) {}
+
+/*
+** copy constructor
+*/
+
+IoBuffer::IoBuffer(const IoBuffer& ref)
+    : head_(NULL), tail_(NULL), write_(NULL), begin_(0), size_(0) {
+  *this = ref;
+}
+
+/*
+** assignation operator overload
+**
+** data is copied (offsets are also kept)
+*/
+
+IoBuffer& IoBuffer::operator=(const IoBuffer& rhs) {
+  if (this == &rhs) {
+    return *this;
+  }
+  clear();
+  for (IoBlock* block = rhs.head_; block != NULL; block = block->next) {
+    append(block->data + block->start, block->end - block->start);
+  }
+  begin_ = rhs.begin_;
+  return *this;
+}
+
+/*
+** destructor
+**
+** return all blocks to free list
+*/
+
+IoBuffer::~IoBuffer() { clear(); }
+
+/*
+** getters
+*/
+
+size_t IoBuffer::size() const { return size_; }
+bool IoBuffer::empty() const { return size_ == 0; }
+size_t IoBuffer::getBegin() const { return begin_; }
+size_t IoBuffer::getEnd() const { return begin_ + size_; }
+
+/*
+** function: append
+**
+** append copy of data to end
+*/
+
+void IoBuffer::append(const char* data, size_t len) {
+  while (len > 0) {
+    size_t space;
+    char* dst = prepareWrite(&space);
+    size_t n = std::min(len, space);
+    memcpy(dst, data, n);
+    commitWrite(n);
+    data += n;
+    len -= n;
+  }
+}
+
+void IoBuffer::append(const std::string& str) {
+  append(str.data(), str.size());
+}
+
+/*
+** function: appendBuffer
+**
+** move all blocks of other to end of this buffer without copying data
+*/
+
+void IoBuffer::appendBuffer(IoBuffer& other) {
+  if (other.head_ == NULL) {
+    return;
+  }
+  if (tail_ == NULL) {
+    head_ = other.head_;
+  } else {
+    tail_->next = other.head_;
+  }
+  tail_ = other.tail_;
+  size_ += other.size_;
+  other.head_ = NULL;
+  other.tail_ = NULL;
+  other.begin_ += other.size_;
+  other.size_ = 0;
+}
+
+/*
+** function: prepareWrite
+**
+** returns free space of last block (new block is added if it is full)
+*/
+
+char* IoBuffer::prepareWrite(size_t* len) {
+  if (tail_ == NULL || tail_->end == IOBUF_BLOCK_SIZE) {
+    IoBlock* block = allocateBlock();
+    if (tail_ == NULL) {
+      head_ = block;
+    } else {
+      tail_->next = block;
+    }
+    tail_ = block;
+  }
+  *len = IOBUF_BLOCK_SIZE - tail_->end;
+  return tail_->data + tail_->end;
+}
+
+/*
+** function: commitWrite
+**
+** add n bytes written to the space returned by prepareWrite
+*/
+
+void IoBuffer::commitWrite(size_t n) {
+  tail_->end += n;
+  size_ += n;
+}
+
+/*
+** function: prepareWritev
+**
+** returns free space of last block and of new blocks added after it, up
+** to len bytes or max_iov blocks
+*/
+
+int IoBuffer::prepareWritev(size_t len, struct iovec* iov, int max_iov) {
+  IoBlock* block = tail_;
+  int n = 0;
+
+  if (block != NULL && block->end == IOBUF_BLOCK_SIZE) {
+    block = NULL;
+  }
+  write_ = block;
+  while (len > 0 && n < max_iov) {
+    if (block == NULL) {
+      block = allocateBlock();
+      if (tail_ == NULL) {
+        head_ = block;
+      } else {
+        tail_->next = block;
+      }
+      tail_ = block;
+      if (write_ == NULL) {
+        write_ = block;
+      }
+    }
+    size_t space = std::min(len, IOBUF_BLOCK_SIZE - block->end);
+    iov[n].iov_base = block->data + block->end;
+    iov[n].iov_len = space;
+    ++n;
+    len -= space;
+    block = NULL;  // (block is last one)
+  }
+  return n;
+}
+
+/*
+** function: commitWritev
+**
+** add n bytes written to the space returned by prepareWritev
+** (blocks added but not written to are returned to free list)
+*/
+
+void IoBuffer::commitWritev(size_t n) {
+  IoBlock* block = write_;
+
+  if (block == NULL) {
+    return;
+  }
+  size_ += n;
+  while (n > 0) {
+    size_t len = std::min(n, IOBUF_BLOCK_SIZE - block->end);
+    block->end += len;
+    n -= len;
+    if (n > 0) {
+      block = block->next;
+    }
+  }
+  IoBlock* unused = block->next;
+  block->next = NULL;
+  tail_ = block;
+  while (unused != NULL) {
+    IoBlock* next = unused->next;
+    freeBlock(unused);
+    unused = next;
+  }
+  write_ = NULL;
+}
+
+/*
+** function: consume
+**
+** remove n bytes from head (emptied blocks are returned to free list)
+*/
+
+void IoBuffer::consume(size_t n) {
+  n = std::min(n, size_);
+  begin_ += n;
+  size_ -= n;
+  while (n > 0 || (head_ != NULL && head_->start == head_->end)) {
+    size_t len = std::min(n, head_->end - head_->start);
+    head_->start += len;
+    n -= len;
+    if (head_->start == head_->end) {
+      IoBlock* next = head_->next;
+      freeBlock(head_);
+      head_ = next;
+    }
+  }
+  if (head_ == NULL) {
+    tail_ = NULL;
+  }
+}
+
+void IoBuffer::consumeTo(size_t off) {
+  if (off > begin_) {
+    consume(off - begin_);
+  }
+}
+
+/*
+** function: peek
+**
+** returns pointer to data at offset off and length contiguous from there
+** (NULL and 0 if off is not in buffer)
+*/
+
+const char* IoBuffer::peek(size_t off, size_t* len) const {
+  if (off < begin_ || off >= begin_ + size_) {
+    *len = 0;
+    return NULL;
+  }
+  off -= begin_;
+  for (IoBlock* block = head_; block != NULL; block = block->next) {
+    size_t n = block->end - block->start;
+    if (off < n) {
+      *len = n - off;
+      return block->data + block->start + off;
+    }
+    off -= n;
+  }
+  *len = 0;
+  return NULL;
+}
+
+/*
+** function: getIovec
+**
+** fill iov with len bytes from offset off (to pass writev)
+*/
+
+int IoBuffer::getIovec(size_t off, size_t len, struct iovec* iov,
+                       int max_iov) const {
+  int n = 0;
+
+  while (len > 0 && n < max_iov) {
+    size_t n_peek;
+    const char* data = peek(off, &n_peek);
+    if (data == NULL) {
+      break;
+    }
+    n_peek = std::min(n_peek, len);
+    iov[n].iov_base = const_cast<char*>(data);
+    iov[n].iov_len = n_peek;
+    ++n;
+    off += n_peek;
+    len -= n_peek;
+  }
+  return n;
+}
+
+/*
+** function: makeContiguous
+**
+** make data from offset off contiguous (up to IOBUF_BLOCK_SIZE bytes)
+**    - used to keep request line and headers contiguous for parser
+**    - if data reaches end of buffer, free space is also kept after it
+**      so that data received next is contiguous with it
+**    - data is copied to new block only if it is not already so
+**    - offsets of data are not changed
+*/
+
+void IoBuffer::makeContiguous(size_t off) {
+  if (off < begin_ || off >= getEnd()) {
+    return;
+  }
+  size_t len = getEnd() - off;
+  len = std::min(len, static_cast<size_t>(IOBUF_BLOCK_SIZE));
+
+  // find block including offset off
+  IoBlock* prev = NULL;
+  IoBlock* block = head_;
+  size_t pos = begin_;
+  while (pos + (block->end - block->start) <= off) {
+    pos += block->end - block->start;
+    prev = block;
+    block = block->next;
+  }
+  size_t skip = off - pos;
+  size_t n = block->end - block->start - skip;
+  if (n >= len && (block->end < IOBUF_BLOCK_SIZE || off + len < getEnd() ||
+                   len == IOBUF_BLOCK_SIZE)) {
+    return;  // already contiguous
+  }
+
+  // move data to new block (rest of this block and head of next blocks)
+  IoBlock* new_block = allocateBlock();
+  memcpy(new_block->data, block->data + block->start + skip, n);
+  block->end -= n;
+  size_t copied = n;
+  IoBlock* next = block->next;
+  while (copied < len) {
+    n = std::min(len - copied, next->end - next->start);
+    memcpy(new_block->data + copied, next->data + next->start, n);
+    next->start += n;
+    copied += n;
+    if (next->start == next->end) {
+      IoBlock* tmp = next->next;
+      freeBlock(next);
+      next = tmp;
+    }
+  }
+  new_block->end = copied;
+
+  // link new block in place of moved data
+  new_block->next = next;
+  if (next == NULL) {
+    tail_ = new_block;
+  }
+  if (block->start == block->end) {
+    if (prev == NULL) {
+      head_ = new_block;
+    } else {
+      prev->next = new_block;
+    }
+    freeBlock(block);
+  } else {
+    block->next = new_block;
+  }
+}
+
+/*
+** function: clear
+**
+** remove all data
+*/
+
+void IoBuffer::clear() {
+  consume(size_);
+}
@@ -0,0 +1,97 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   IoBuffer.hpp                                       :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/13 14:22:18 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/28 18:40:00 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef IOBUFFER_HPP
+#define IOBUFFER_HPP
+
+#include <sys/types.h>
+#include <sys/uio.h>  // iovec
+
+#include <string>
+
+#include "config.hpp"
+
+// fixed size block of IoBuffer (data is in [start, end) of data)
+struct IoBlock {
+  IoBlock* next;
+  size_t start;
+  size_t end;
+  char data[IOBUF_BLOCK_SIZE];
+};
+
+/*
+** buffer made of chain of fixed size blocks
+**
+** data is appended to the last block and consumed from the first block,
+** so no data is moved when consumed (empty blocks are returned to pool).
+** every byte has a logical offset which never changes while it is in the
+** buffer (offset of first byte is getBegin(), next of last is getEnd()).
+** blocks are taken from free list of each thread, not from allocator.
+*/
+
+class IoBuffer {
+ private:
+  IoBlock* head_;   // first block
+  IoBlock* tail_;   // last block
+  IoBlock* write_;  // first block of space prepared by prepareWritev
+  size_t begin_;    // logical offset of first byte
+  size_t size_;     // bytes in buffer
+
+  static IoBlock* allocateBlock();
+  static void freeBlock(IoBlock* block);
+
+ public:
+  IoBuffer();
+  IoBuffer(const IoBuffer& ref);
+  IoBuffer& operator=(const IoBuffer& ref);
+  ~IoBuffer();
+
+  // getters
+  size_t size() const;
+  bool empty() const;
+  size_t getBegin() const;
+  size_t getEnd() const;
+
+  // append copy of data
+  void append(const char* data, size_t len);
+  void append(const std::string& str);
+
+  // move all blocks of other to end of this buffer (other becomes empty)
+  void appendBuffer(IoBuffer& other);
+
+  // returns free space at end to write directly (e.g. by recv)
+  // and commitWrite(n) after n bytes are written to it
+  char* prepareWrite(size_t* len);
+  void commitWrite(size_t n);
+
+  // same for len bytes of free space in more blocks (e.g. by readv), fill
+  // iov with it (returns number of iovec filled)
+  int prepareWritev(size_t len, struct iovec* iov, int max_iov);
+  void commitWritev(size_t n);
+
+  // remove n bytes from head (or bytes before offset off)
+  void consume(size_t n);
+  void consumeTo(size_t off);
+
+  // returns pointer to data at offset off and its contiguous length
+  const char* peek(size_t off, size_t* len) const;
+
+  // fill iov with len bytes from offset off (returns number of iovec filled)
+  int getIovec(size_t off, size_t len, struct iovec* iov, int max_iov) const;
+
+  // make data from offset off contiguous (to parse headers in place)
+  void makeContiguous(size_t off);
+
+  void clear();
+};
+
+#endif /* IOBUFFER_HPP */
@@ -0,0 +1,308 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Logger.cpp                                         :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/16 11:30:08 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/28 16:52:00 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Logger.hpp"
+
+#include <errno.h>
+#include <stdio.h>    // snprintf
+#include <string.h>   // memcpy
+#include <sys/uio.h>  // writev
+#include <unistd.h>   // usleep
+
+#include <algorithm>
+#include <stdexcept>
+
+/*
+** ring of current thread (registered to Logger at first log)
+*/
+
+static __thread LogRing* g_ring = NULL;
+
+/*
+** function: getLevelTag
+**
+** returns prefix of record of level
+*/
+
+static const char* getLevelTag(int level) {
+  switch (level) {
+    case LOG_LEVEL_DEBUG:
+      return "[debug] ";
+    case LOG_LEVEL_INFO:
+      return "[info] ";
+    case LOG_LEVEL_WARN:
+      return "[warn] ";
+    default:
+      return "[error] ";
+  }
+}
+
+/*
+** constructor of LogRecord
+**
+** start record with tag of level
+*/
+
+LogRecord::LogRecord(int level) : len_(0) { *this << getLevelTag(level); }
+
+/*
+** destructor of LogRecord
+**
+** end record with newline and put it in ring
+*/
+
+LogRecord::~LogRecord() {
+  buf_[len_++] = '\n';  // one byte is always left for newline (see append)
+  Logger::getInstance().put(buf_, len_);
+}
+
+/*
+** function: append
+**
+** append str to record (truncated if record is too long)
+*/
+
+LogRecord& LogRecord::append(const char* str, size_t len) {
+  len = std::min(len, LOG_RECORD_MAX - 1 - len_);
+  memcpy(buf_ + len_, str, len);
+  len_ += len;
+  return *this;
+}
+
+/*
+** operator<< overloads
+**
+** numbers are formatted without locale nor allocation
+*/
+
+LogRecord& LogRecord::operator<<(const char* str) {
+  append(str, strlen(str));
+  return *this;
+}
+
+LogRecord& LogRecord::operator<<(const std::string& str) {
+  append(str.data(), str.size());
+  return *this;
+}
+
+LogRecord& LogRecord::operator<<(char c) {
+  append(&c, 1);
+  return *this;
+}
+
+LogRecord& LogRecord::operator<<(int n) {
+  return *this << static_cast<long>(n);
+}
+
+LogRecord& LogRecord::operator<<(long n) {
+  if (n < 0) {
+    append("-", 1);
+    return *this << static_cast<unsigned long>(-(n + 1)) + 1;
+  }
+  return *this << static_cast<unsigned long>(n);
+}
+
+LogRecord& LogRecord::operator<<(unsigned int n) {
+  return *this << static_cast<unsigned long>(n);
+}
+
+LogRecord& LogRecord::operator<<(unsigned long n) {
+  char digits[20];
+  size_t i = sizeof(digits);
+
+  do {
+    digits[--i] = '0' + n % 10;
+    n /= 10;
+  } while (n > 0);
+  append(digits + i, sizeof(digits) - i);
+  return *this;
+}
+
+/*
+** constructor of Logger
+**
+** log is written to stdout
+*/
+
+Logger::Logger()
+    : fd_(STDOUT_FILENO), rings_(NULL), writer_(), started_(false) {
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+/*
+** destructor of Logger
+**
+** rings are not freed (threads may log until process exits)
+*/
+
+Logger::~Logger() {}
+
+/*
+** function: getInstance
+**
+** returns logger shared by all threads
+*/
+
+Logger& Logger::getInstance() {
+  static Logger instance;
+  return instance;
+}
+
+/*
+** function: start
+**
+** start writer thread flushing rings in background
+*/
+
+void Logger::start() {
+  if (started_) {
+    return;
+  }
+  if (pthread_create(&writer_, NULL, runWriter, this) != 0) {
+    throw std::runtime_error("webserv: Logger: cannot start writer thread");
+  }
+  pthread_detach(writer_);
+  started_ = true;
+}
+
+/*
+** function: runWriter
+**
+** main loop of writer thread (records are written in batch)
+*/
+
+void* Logger::runWriter(void* arg) {
+  Logger* logger = static_cast<Logger*>(arg);
+
+  while (1) {
+    logger->flush();
+    usleep(LOG_FLUSH_INTERVAL_MS * 1000);
+  }
+  return NULL;
+}
+
+/*
+** function: flush
+**
+** write records in all rings (only one thread flushes at a time)
+*/
+
+size_t Logger::flush() {
+  size_t written = 0;
+
+  pthread_mutex_lock(&mutex_);
+  for (LogRing* ring = rings_; ring != NULL; ring = ring->next) {
+    written += flushRing(ring);
+  }
+  pthread_mutex_unlock(&mutex_);
+  return written;
+}
+
+/*
+** function: flushRing
+**
+** write records in ring by one writev (data may wrap around end of ring)
+**    - number of records dropped since last flush is reported before them
+*/
+
+size_t Logger::flushRing(LogRing* ring) {
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  size_t tail = ring->tail;
+  unsigned long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+  struct iovec iov[3];
+  int n_iov = 0;
+  char msg[64];
+
+  if (dropped != ring->reported) {
+    iov[n_iov].iov_base = msg;
+    iov[n_iov++].iov_len =
+        snprintf(msg, sizeof(msg), "[warn] %lu log records dropped\n",
+                 dropped - ring->reported);
+    ring->reported = dropped;
+  }
+  if (head != tail) {
+    size_t off = tail % LOG_RING_SIZE;
+    size_t len = std::min(head - tail, LOG_RING_SIZE - off);
+    iov[n_iov].iov_base = ring->data + off;
+    iov[n_iov++].iov_len = len;
+    if (len < head - tail) {
+      iov[n_iov].iov_base = ring->data;
+      iov[n_iov++].iov_len = head - tail - len;
+    }
+  }
+
+  // write all, continued after partial write or signal (records are
+  // discarded if failed)
+  struct iovec* rest = iov;
+  while (n_iov > 0) {
+    ssize_t n = writev(fd_, rest, n_iov);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      break;
+    }
+    while (n_iov > 0 && static_cast<size_t>(n) >= rest->iov_len) {
+      n -= rest->iov_len;
+      ++rest;
+      --n_iov;
+    }
+    if (n_iov > 0) {
+      rest->iov_base = static_cast<char*>(rest->iov_base) + n;
+      rest->iov_len -= n;
+    }
+  }
+  __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+  return head - tail;
+}
+
+/*
+** function: getRing
+**
+** returns ring of current thread (allocated and registered at first call)
+*/
+
+LogRing* Logger::getRing() {
+  if (g_ring == NULL) {
+    g_ring = new LogRing;
+    g_ring->head = 0;
+    g_ring->tail = 0;
+    g_ring->dropped = 0;
+    g_ring->reported = 0;
+    pthread_mutex_lock(&mutex_);
+    g_ring->next = rings_;
+    rings_ = g_ring;
+    pthread_mutex_unlock(&mutex_);
+  }
+  return g_ring;
+}
+
+/*
+** function: put
+**
+** copy record to ring of current thread (dropped if ring is full)
+*/
+
+void Logger::put(const char* record, size_t len) {
+  LogRing* ring = getRing();
+  size_t head = ring->head;
+  size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+  if (LOG_RING_SIZE - (head - tail) < len) {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return;
+  }
+  size_t off = head % LOG_RING_SIZE;
+  size_t n = std::min(len, LOG_RING_SIZE - off);
+  memcpy(ring->data + off, record, n);
+  memcpy(ring->data, record + n, len - n);
+  __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,158 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Logger.hpp                                         :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/16 11:30:08 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/16 16:52:31 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <string>
+
+#include "config.hpp"
+
+// levels of log (records below LOG_LEVEL in config.hpp are compiled out)
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+/*
+** macros to log a record (arguments are joined by <<)
+**
+**    LOG_INFO("worker " << id << " started");
+**
+** record is formatted in buffer on stack and copied to ring of the thread,
+** so logging never calls system call nor allocates memory
+*/
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(msg)                 \
+  do {                                 \
+    LogRecord(LOG_LEVEL_DEBUG) << msg; \
+  } while (0)
+#else
+#define LOG_DEBUG(msg) \
+  do {                 \
+  } while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(msg)                 \
+  do {                                \
+    LogRecord(LOG_LEVEL_INFO) << msg; \
+  } while (0)
+#else
+#define LOG_INFO(msg) \
+  do {                \
+  } while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(msg)                 \
+  do {                                \
+    LogRecord(LOG_LEVEL_WARN) << msg; \
+  } while (0)
+#else
+#define LOG_WARN(msg) \
+  do {                \
+  } while (0)
+#endif
+
+#define LOG_ERROR(msg)                 \
+  do {                                 \
+    LogRecord(LOG_LEVEL_ERROR) << msg; \
+  } while (0)
+
+// ring buffer of log of one thread (one writer thread and one flusher)
+struct LogRing {
+  char data[LOG_RING_SIZE];
+  size_t head;             // total bytes written (by owner thread)
+  size_t tail;             // total bytes flushed (by flusher thread)
+  unsigned long dropped;   // records dropped because ring was full
+  unsigned long reported;  // dropped records already reported
+  LogRing* next;           // next ring registered
+};
+
+/*
+** one line of log (formatted in constructor and operator<<,
+** and put in ring of current thread in destructor)
+*/
+
+class LogRecord {
+ private:
+  char buf_[LOG_RECORD_MAX];
+  size_t len_;
+
+  // do not allow copy and assignation
+  LogRecord(const LogRecord& ref);
+  LogRecord& operator=(const LogRecord& ref);
+
+ public:
+  explicit LogRecord(int level);
+  ~LogRecord();
+
+  LogRecord& operator<<(const char* str);
+  LogRecord& operator<<(const std::string& str);
+  LogRecord& operator<<(char c);
+  LogRecord& operator<<(int n);
+  LogRecord& operator<<(long n);
+  LogRecord& operator<<(unsigned int n);
+  LogRecord& operator<<(unsigned long n);
+
+  // append str of len bytes (str needs not to be terminated)
+  LogRecord& append(const char* str, size_t len);
+};
+
+/*
+** writes records in rings of all threads to fd in background
+**
+** rings are flushed in batch every LOG_FLUSH_INTERVAL_MS by writer thread
+** (started by start()), so threads logging do not wait for write.
+** records are dropped (and counted) if ring of the thread is full.
+*/
+
+class Logger {
+ private:
+  int fd_;                  // fd to write log
+  LogRing* rings_;          // rings of all threads
+  pthread_mutex_t mutex_;   // lock for rings_ (only to add and traverse)
+  pthread_t writer_;        // thread flushing rings
+  bool started_;            // writer thread is running
+
+  Logger();
+  ~Logger();
+
+  // do not allow copy and assignation
+  Logger(const Logger& ref);
+  Logger& operator=(const Logger& ref);
+
+  static void* runWriter(void* arg);
+  size_t flushRing(LogRing* ring);
+
+ public:
+  static Logger& getInstance();
+
+  // start writer thread
+  void start();
+
+  // write all records now (returns bytes written)
+  size_t flush();
+
+  // returns ring of current thread (created at first call)
+  LogRing* getRing();
+
+  // put record in ring of current thread
+  void put(const char* record, size_t len);
+};
+
+#endif /* LOGGER_HPP */
@@ -0,0 +1,263 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Metrics.cpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/17 10:48:16 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/28 19:05:00 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Metrics.hpp"
+
+#include <stdio.h>   // snprintf
+#include <string.h>  // memset
+#include <time.h>    // clock_gettime
+
+Metrics* Metrics::all_ = NULL;
+pthread_mutex_t Metrics::mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+** metrics of current thread
+*/
+
+static __thread Metrics* g_metrics = NULL;
+
+/*
+** function: load / store
+**
+** access value updated by owner thread and read by other threads
+** (only owner writes it, so no atomic read-modify-write is needed)
+*/
+
+template <typename T>
+static T load(const T* value) {
+  return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+template <typename T>
+static void store(T* value, T n) {
+  __atomic_store_n(value, n, __ATOMIC_RELAXED);
+}
+
+/*
+** constructor
+**
+** all values start from 0
+*/
+
+Metrics::Metrics() : next_(NULL) {
+  memset(counters_, 0, sizeof(counters_));
+  memset(sessions_, 0, sizeof(sessions_));
+  memset(state_durations_, 0, sizeof(state_durations_));
+  memset(&request_durations_, 0, sizeof(request_durations_));
+  memset(&build_durations_, 0, sizeof(build_durations_));
+}
+
+/*
+** function: getLocal
+**
+** returns metrics of current thread (allocated and registered at first call)
+*/
+
+Metrics& Metrics::getLocal() {
+  if (g_metrics == NULL) {
+    g_metrics = new Metrics;
+    pthread_mutex_lock(&mutex_);
+    g_metrics->next_ = all_;
+    all_ = g_metrics;
+    pthread_mutex_unlock(&mutex_);
+  }
+  return *g_metrics;
+}
+
+/*
+** function: getTimeUs
+**
+** returns time of monotonic clock (not affected by change of system time)
+*/
+
+unsigned long Metrics::getTimeUs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000UL + ts.tv_nsec / 1000;
+}
+
+/*
+** functions to update metrics (called only by owner thread)
+*/
+
+void Metrics::add(MetricCounter counter, unsigned long n) {
+  store(&counters_[counter], counters_[counter] + n);
+}
+
+void Metrics::addSessions(SessionStatus status, long n) {
+  store(&sessions_[status], sessions_[status] + n);
+}
+
+void Metrics::observeState(SessionStatus status, unsigned long us) {
+  observe(&state_durations_[status], us);
+}
+
+void Metrics::observeRequest(unsigned long us) {
+  observe(&request_durations_, us);
+}
+
+void Metrics::observeBuild(unsigned long us) {
+  observe(&build_durations_, us);
+}
+
+/*
+** function: observe
+**
+** add duration to histogram (bucket is found by bit length of us)
+*/
+
+void Metrics::observe(MetricHistogram* histogram, unsigned long us) {
+  int bucket = 0;
+
+  while (bucket < METRICS_HIST_BUCKETS - 1 && (us >> bucket) != 0) {
+    ++bucket;
+  }
+  store(&histogram->buckets[bucket], histogram->buckets[bucket] + 1);
+  store(&histogram->count, histogram->count + 1);
+  store(&histogram->sum_us, histogram->sum_us + us);
+}
+
+/*
+** function: merge
+**
+** add values of histogram src to dst
+*/
+
+void Metrics::merge(MetricHistogram* dst, const MetricHistogram& src) {
+  for (int i = 0; i < METRICS_HIST_BUCKETS; ++i) {
+    dst->buckets[i] += load(&src.buckets[i]);
+  }
+  dst->count += load(&src.count);
+  dst->sum_us += load(&src.sum_us);
+}
+
+/*
+** function: formatHistogram
+**
+** append histogram in prometheus format (buckets are cumulative, in sec)
+*/
+
+void Metrics::formatHistogram(std::string* out, const char* name,
+                              const char* labels,
+                              const MetricHistogram& histogram) {
+  char line[256];
+  unsigned long cumulative = 0;
+  const char* sep = labels[0] != '\0' ? "," : "";
+
+  for (int i = 0; i < METRICS_HIST_BUCKETS; ++i) {
+    cumulative += histogram.buckets[i];
+    if (i == METRICS_HIST_BUCKETS - 1) {
+      snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name,
+               labels, sep, cumulative);
+    } else {
+      snprintf(line, sizeof(line), "%s_bucket{%s%sle=\"%.6f\"} %lu\n", name,
+               labels, sep, static_cast<double>(1UL << i) / 1000000,
+               cumulative);
+    }
+    *out += line;
+  }
+  if (labels[0] != '\0') {
+    snprintf(line, sizeof(line), "%s_sum{%s} %.6f\n%s_count{%s} %lu\n", name,
+             labels, static_cast<double>(histogram.sum_us) / 1000000, name,
+             labels, histogram.count);
+  } else {
+    snprintf(line, sizeof(line), "%s_sum %.6f\n%s_count %lu\n", name,
+             static_cast<double>(histogram.sum_us) / 1000000, name,
+             histogram.count);
+  }
+  *out += line;
+}
+
+/*
+** function: format
+**
+** merge metrics of all threads and returns them in prometheus text format
+*/
+
+std::string Metrics::format() {
+  static const char* counter_names[METRIC_COUNTER_NUM] = {
+      "webserv_connections_accepted_total",
+      "webserv_connections_dropped_total",
+      "webserv_connections_timed_out_total",
+      "webserv_requests_total",
+      "webserv_responses_total{code=\"2xx\"}",
+      "webserv_responses_total{code=\"3xx\"}",
+      "webserv_responses_total{code=\"4xx\"}",
+      "webserv_responses_total{code=\"5xx\"}",
+      "webserv_sent_bytes_total"};
+  unsigned long counters[METRIC_COUNTER_NUM] = {};
+  long sessions[SESSION_STATUS_NUM] = {};
+  MetricHistogram state_durations[SESSION_STATUS_NUM];
+  MetricHistogram request_durations;
+  MetricHistogram build_durations;
+  std::string out;
+  char line[256];
+
+  // merge all
+  memset(state_durations, 0, sizeof(state_durations));
+  memset(&request_durations, 0, sizeof(request_durations));
+  memset(&build_durations, 0, sizeof(build_durations));
+  pthread_mutex_lock(&mutex_);
+  for (Metrics* metrics = all_; metrics != NULL; metrics = metrics->next_) {
+    for (int i = 0; i < METRIC_COUNTER_NUM; ++i) {
+      counters[i] += load(&metrics->counters_[i]);
+    }
+    for (int i = 0; i < SESSION_STATUS_NUM; ++i) {
+      sessions[i] += load(&metrics->sessions_[i]);
+      merge(&state_durations[i], metrics->state_durations_[i]);
+    }
+    merge(&request_durations, metrics->request_durations_);
+    merge(&build_durations, metrics->build_durations_);
+  }
+  pthread_mutex_unlock(&mutex_);
+
+  // counters (TYPE line is written once for names with labels)
+  std::string last_name;
+  for (int i = 0; i < METRIC_COUNTER_NUM; ++i) {
+    std::string name(counter_names[i]);
+    name = name.substr(0, name.find('{'));
+    if (name != last_name) {
+      out += "# TYPE " + name + " counter\n";
+      last_name = name;
+    }
+    snprintf(line, sizeof(line), "%s %lu\n", counter_names[i], counters[i]);
+    out += line;
+  }
+
+  // sessions in each status and time spent in it
+  out += "# TYPE webserv_sessions gauge\n";
+  for (int i = 0; i < SESSION_STATUS_NUM; ++i) {
+    const char* state = Session::getStatusName(static_cast<SessionStatus>(i));
+    if (state != NULL) {
+      snprintf(line, sizeof(line), "webserv_sessions{state=\"%s\"} %ld\n",
+               state, sessions[i]);
+      out += line;
+    }
+  }
+  out += "# TYPE webserv_session_state_seconds histogram\n";
+  for (int i = 0; i < SESSION_STATUS_NUM; ++i) {
+    const char* state = Session::getStatusName(static_cast<SessionStatus>(i));
+    if (state != NULL) {
+      snprintf(line, sizeof(line), "state=\"%s\"", state);
+      formatHistogram(&out, "webserv_session_state_seconds", line,
+                      state_durations[i]);
+    }
+  }
+  out += "# TYPE webserv_request_duration_seconds histogram\n";
+  formatHistogram(&out, "webserv_request_duration_seconds", "",
+                  request_durations);
+  out += "# TYPE webserv_response_build_seconds histogram\n";
+  formatHistogram(&out, "webserv_response_build_seconds", "",
+                  build_durations);
+  return out;
+}
@@ -0,0 +1,92 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Metrics.hpp                                        :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/17 10:48:16 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/28 19:05:00 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <pthread.h>
+
+#include <string>
+
+#include "Session.hpp"
+#include "config.hpp"
+
+// counters of events
+enum MetricCounter {
+  METRIC_ACCEPTED,   // connections accepted
+  METRIC_DROPPED,    // connections dropped without session
+  METRIC_TIMED_OUT,  // sessions closed by timeout
+  METRIC_REQUESTS,   // requests started
+  METRIC_RESPONSES_2XX,
+  METRIC_RESPONSES_3XX,
+  METRIC_RESPONSES_4XX,
+  METRIC_RESPONSES_5XX,
+  METRIC_BYTES_SENT,  // bytes sent to clients
+  METRIC_COUNTER_NUM
+};
+
+// histogram of durations (bucket i counts values less than 2^i usec)
+struct MetricHistogram {
+  unsigned long buckets[METRICS_HIST_BUCKETS];
+  unsigned long count;
+  unsigned long sum_us;
+};
+
+/*
+** counters, gauges and histograms of one worker thread
+**
+** each thread updates only its own metrics without lock (one writer),
+** and all of them are read and merged only when requested (format).
+*/
+
+class Metrics {
+ private:
+  unsigned long counters_[METRIC_COUNTER_NUM];
+  long sessions_[SESSION_STATUS_NUM];  // sessions in each status
+  MetricHistogram state_durations_[SESSION_STATUS_NUM];  // time in status
+  MetricHistogram request_durations_;  // from start to response sent
+  MetricHistogram build_durations_;    // from start to response made
+  Metrics* next_;                      // next metrics registered
+
+  static Metrics* all_;            // metrics of all threads
+  static pthread_mutex_t mutex_;  // lock for all_ (only to add and read)
+
+  Metrics();
+
+  // do not allow copy and assignation
+  Metrics(const Metrics& ref);
+  Metrics& operator=(const Metrics& ref);
+
+  static void observe(MetricHistogram* histogram, unsigned long us);
+  static void merge(MetricHistogram* dst, const MetricHistogram& src);
+  static void formatHistogram(std::string* out, const char* name,
+                              const char* labels,
+                              const MetricHistogram& histogram);
+
+ public:
+  // returns metrics of current thread (created at first call)
+  static Metrics& getLocal();
+
+  // returns current time of monotonic clock in usec
+  static unsigned long getTimeUs();
+
+  // returns metrics of all threads merged in prometheus text format
+  static std::string format();
+
+  void add(MetricCounter counter, unsigned long n);
+  void addSessions(SessionStatus status, long n);
+  void observeState(SessionStatus status, unsigned long us);
+  void observeRequest(unsigned long us);
+  void observeBuild(unsigned long us);
+};
+
+#endif /* METRICS_HPP */
@@ -0,0 +1,469 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Server.cpp                                         :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/03 13:20:51 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/28 18:40:00 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Server.hpp"
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <vector>
+
+#include "CgiPool.hpp"
+#include "FilePool.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+
+/*
+** default constructor
+**
+** socket and epoll are initialized in init()
+*/
+
+Server::Server() : id_(0), accept_pending_(false) {}
+
+/*
+** destructor
+**
+** socket and epoll are closed by their destructors
+*/
+
+Server::~Server() {}
+
+/*
+** getters
+*/
+
+int Server::getId() const { return id_; }
+
+/*
+** function: init
+**
+** initialize listening socket and epoll instance of this worker
+*/
+
+void Server::init(int id, int port) {
+  id_ = id;
+
+  // initialize socket
+  sock_.init(port);
+  LOG_INFO("worker " << id_ << ": socket initialized");
+
+  // initialize epoll (or io_uring) and register listening socket
+  epoll_.init(EPOLL_EDGE_TRIGGERED, IO_URING_ENABLED);
+  LOG_INFO("worker " << id_ << ": wait for events by "
+                     << (epoll_.isUring() ? "io_uring" : "epoll"));
+  if (epoll_.watch(sock_.getFd(), EPOLLIN, sock_.getFd()) == -1) {
+    throw std::runtime_error("webserv: Server: cannot watch socket");
+  }
+
+  // start timer wheel from now
+  timers_.init(time(NULL));
+}
+
+/*
+** function: getWatchFd
+**
+** returns fd to wait for in current status of session (or -1 if none)
+** and store events to wait for to *events
+**    - session waiting for an idle cgi worker has no fd to wait for
+**    - session waiting for FilePool is resumed by FileCompletions
+**    - session whose I/O is submitted to io_uring is resumed by its
+**      completion
+*/
+
+static int getWatchFd(const Session& session, uint32_t* events) {
+  switch (session.getStatus()) {
+    case SESSION_FOR_CLIENT_RECV:
+      *events = EPOLLIN;
+      return session.isIoSubmitted() ? -1 : session.getSockFd();
+    case SESSION_FOR_CLIENT_SEND:
+      *events = EPOLLOUT;
+      return session.isIoSubmitted() ? -1 : session.getSockFd();
+    case SESSION_FOR_FILE_WRITE:  // (not while waiting for request body)
+      *events = EPOLLOUT;
+      return session.hasFileInput() ? session.getFileFd() : -1;
+    case SESSION_FOR_CGI_WRITE:  // (not while waiting for request body)
+      *events = EPOLLOUT;
+      return session.hasCgiInput() ? session.getCgiFd() : -1;
+    case SESSION_FOR_CGI_READ:
+      *events = EPOLLIN;
+      return session.getCgiFd();
+    default:
+      *events = 0;
+      return -1;
+  }
+}
+
+/*
+** function: handleSession
+**
+** call I/O function of session according to its status
+** returns -1 if session should be closed
+*/
+
+static int handleSession(Session& session) {
+  switch (session.getStatus()) {
+    case SESSION_FOR_CLIENT_RECV:
+      if (session.recvReq() == -1) {
+        return -1;  // delete session if failed to recv
+      }
+      LOG_DEBUG("received request data");
+      return 0;
+    case SESSION_FOR_CLIENT_SEND:
+      if (session.sendRes() != 0) {
+        LOG_DEBUG("sent response data");
+        return -1;  // delete session if failed or ended
+      }
+      return 0;
+    case SESSION_FOR_FILE_WRITE:
+      if (session.writeToFile() == -1) {
+        return -1;
+      }
+      LOG_DEBUG("write data to file");
+      return 0;
+    case SESSION_FOR_CGI_WRITE:
+      if (session.writeToCgiProcess() == -1) {
+        return -1;
+      }
+      LOG_DEBUG("wrote data to cgi");
+      return 0;
+    case SESSION_FOR_CGI_READ:
+      if (session.readFromCgiProcess() == -1) {
+        return -1;
+      }
+      LOG_DEBUG("read data from cgi");
+      return 0;
+    case SESSION_FOR_FILE_IO:
+      if (session.finishFileJob() != 0) {
+        return -1;  // delete session if failed or ended (as sendRes)
+      }
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+/*
+** function: processSession
+**
+** handle ready session and update epoll registration on status transition
+** (timer of session is updated after this)
+**    - in edge triggered mode, call I/O function until it would block
+**      (if not drained in EPOLL_EDGE_IO_MAX calls, continue in next loop)
+**    - with io_uring, call I/O function with client until its next recv or
+**      send is submitted (in the same limit), it is not polled
+**    - regular files cannot be registered to epoll (always ready),
+**      so the session is processed again in next loop
+**    - socket is also watched while request body is received for cgi
+**      (both fds are registered with key of session)
+*/
+
+void Server::processSession(int key) {
+  Session& session = *sessions_.get(key);
+  uint32_t old_events;
+  uint32_t new_events;
+  int old_fd = getWatchFd(session, &old_events);
+  SessionStatus old_status = session.getStatus();
+  bool old_receiving = session.isBodyReceiving();
+  int n_io = 0;
+
+  while (1) {
+    if (handleSession(session) == -1) {
+      closeSession(key, old_fd);
+      return;
+    }
+    ++n_io;
+    if (epoll_.isUring()) {
+      if ((session.getStatus() != SESSION_FOR_CLIENT_RECV &&
+           session.getStatus() != SESSION_FOR_CLIENT_SEND) ||
+          session.isIoSubmitted() || session.isIoBlocked()) {
+        break;
+      }
+    } else if (!epoll_.isEdgeTriggered() ||
+               session.getStatus() != old_status || session.isIoBlocked()) {
+      break;
+    }
+    if (n_io == EPOLL_EDGE_IO_MAX) {
+      pending_.insert(key);  // not drained yet
+      break;
+    }
+  }
+
+  // change registration only when fd to wait for changed
+  // (cgi worker may be got or released without change of status)
+  int new_fd = getWatchFd(session, &new_events);
+  if (session.getStatus() == old_status && new_fd == old_fd) {
+    if (old_fd >= 0 && epoll_.watch(old_fd, old_events, key) == -1 &&
+        errno == EPERM) {
+      pending_.insert(key);
+    }
+  } else {
+    if (old_fd != new_fd) {
+      epoll_.unwatch(old_fd);
+    }
+    if (new_fd >= 0 && epoll_.watch(new_fd, new_events, key) == -1) {
+      if (errno == EPERM) {
+        pending_.insert(key);  // regular file
+      } else {
+        LOG_ERROR("failed to watch fd");
+      }
+    }
+  }
+
+  if (session.isBodyReceiving()) {
+    epoll_.watch(session.getSockFd(), EPOLLIN, key);
+  } else if (old_receiving && new_fd != session.getSockFd()) {
+    epoll_.unwatch(session.getSockFd());
+  }
+}
+
+/*
+** function: closeSession
+**
+** stop watching fds of session and return it to table
+** (fds are already closed by session)
+*/
+
+void Server::closeSession(int key, int watched_fd) {
+  epoll_.unwatch(watched_fd);
+  epoll_.unwatch(key);
+  pending_.erase(key);
+  timers_.cancel(sessions_.get(key)->getTimer());
+  sessions_.destroy(key);
+}
+
+/*
+** function: updateTimer
+**
+** arm timer of session at its deadline in current status
+** (timer is not touched if deadline is not changed)
+*/
+
+void Server::updateTimer(int key) {
+  Session* session = sessions_.get(key);
+  TimerNode* timer = session->getTimer();
+  time_t deadline = session->getDeadline();
+
+  if (deadline == 0) {
+    timers_.cancel(timer);
+  } else if (timer->prev == NULL || timer->expire != deadline) {
+    timers_.arm(timer, deadline);
+  }
+}
+
+/*
+** function: acceptSessions
+**
+** accept new connections until no connection left in queue
+**    - at most ACCEPT_BATCH_MAX connections in a loop not to delay existing
+**      sessions (rest are accepted in next loop without waiting)
+**    - connection is dropped if no fd is left for it
+*/
+
+void Server::acceptSessions() {
+  int n_accepted = 0;
+  int n_dropped = 0;
+
+  accept_pending_ = false;
+  while (1) {
+    if (n_accepted + n_dropped == ACCEPT_BATCH_MAX) {
+      accept_pending_ = true;
+      break;
+    }
+    int accepted_fd = sock_.acceptRequest();
+    if (accepted_fd == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        break;  // queue is empty
+      } else if (errno == EMFILE || errno == ENFILE) {
+        if (sock_.dropRequest() == -1) {
+          break;
+        }
+        ++n_dropped;
+      } else if (errno == ECONNABORTED || errno == EINTR) {
+        ++n_dropped;  // aborted by client before accepted
+      } else {
+        LOG_ERROR("failed to accept connection");
+        break;
+      }
+      continue;
+    }
+    sessions_.create(accepted_fd);
+    if (epoll_.watch(accepted_fd, EPOLLIN, accepted_fd) == -1) {
+      LOG_ERROR("failed to watch fd");
+      close(accepted_fd);
+      sessions_.destroy(accepted_fd);
+      ++n_dropped;
+      continue;
+    }
+    updateTimer(accepted_fd);
+    ++n_accepted;
+  }
+  Metrics::getLocal().add(METRIC_ACCEPTED, n_accepted);
+  Metrics::getLocal().add(METRIC_DROPPED, n_dropped);
+  LOG_DEBUG("worker " << id_ << ": accepted " << n_accepted << ", dropped "
+                      << n_dropped << " connections");
+}
+
+/*
+** function: resumeCgiSessions
+**
+** process sessions waiting for cgi worker in next loop, as many as idle
+** workers (a session not getting a worker waits in queue again)
+*/
+
+void Server::resumeCgiSessions() {
+  CgiPool& pool = CgiPool::getLocal();
+  int n_idle = pool.getIdleNum();
+  int key;
+
+  while (n_idle > 0 && (key = pool.popWaiting()) != -1) {
+    Session* session = sessions_.get(key);
+    if (session != NULL && session->getStatus() == SESSION_FOR_CGI_WRITE &&
+        session->getCgiFd() == -1) {
+      pending_.insert(key);
+      --n_idle;
+    }
+  }
+}
+
+/*
+** function: resumeFileSessions
+**
+** process sessions whose file I/O is completed by FilePool
+*/
+
+void Server::resumeFileSessions() {
+  std::vector<FileJob*> jobs;
+
+  FileCompletions::getLocal().popAll(&jobs);
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    int key = jobs[i]->key;
+    jobs[i]->finished = true;
+    if (sessions_.get(key) != NULL) {
+      processSession(key);
+    }
+    if (sessions_.get(key) != NULL) {
+      updateTimer(key);
+    }
+  }
+}
+
+/*
+** function: closeTimedOutSessions
+**
+** close sessions whose timer expired (see Session::getDeadline)
+** (session waiting for FilePool or io_uring is abandoned, see
+** Session::abandon)
+*/
+
+void Server::closeTimedOutSessions(time_t now) {
+  TimerNode* timer;
+
+  timers_.advance(now);
+  while ((timer = timers_.popExpired()) != NULL) {
+    Session* session = sessions_.get(timer->key);
+    uint32_t events;
+    int watched_fd = getWatchFd(*session, &events);
+    LOG_INFO("close session timed out");
+    Metrics::getLocal().add(METRIC_TIMED_OUT, 1);
+    if (session->getStatus() == SESSION_FOR_FILE_IO ||
+        session->isIoSubmitted()) {
+      session->abandon();  // closed when its I/O is done
+      continue;
+    }
+    session->closeConnection();
+    closeSession(timer->key, watched_fd);
+  }
+}
+
+/*
+** function: run
+**
+** main loop of worker
+*/
+
+void Server::run() {
+  int n_ev;  // number of ready events
+  struct epoll_event events[EPOLL_MAX_EVENTS];
+  FileCompletions& completions = FileCompletions::getLocal();
+
+  epoll_.makeLocal();
+  completions.init();
+  if (epoll_.watch(completions.getFd(), EPOLLIN, completions.getFd()) == -1) {
+    throw std::runtime_error("webserv: Server: cannot watch completions");
+  }
+
+  while (1) {
+    // wait for fds getting ready (no wait if sessions or connections left)
+    LOG_DEBUG("waiting...");
+    int timeout_ms =
+        (pending_.empty() && !accept_pending_) ? EPOLL_TIMEOUT_MS : 0;
+    n_ev = epoll_.wait(events, EPOLL_MAX_EVENTS, timeout_ms);
+    if (n_ev == -1) {
+      LOG_ERROR("epoll_wait");
+      continue;
+    }
+
+    // process sessions which do not wait for epoll
+    std::set<int> to_process;
+    to_process.swap(pending_);
+    for (std::set<int>::iterator key = to_process.begin();
+         key != to_process.end(); ++key) {
+      if (sessions_.get(*key) != NULL) {
+        processSession(*key);
+      }
+      if (sessions_.get(*key) != NULL) {
+        updateTimer(*key);
+      }
+    }
+
+    // process only ready sessions
+    bool accept_ready = false;
+    bool file_ready = false;
+    for (int i = 0; i < n_ev; ++i) {
+      int key = static_cast<int>(events[i].data.u64);
+      if (key == sock_.getFd()) {
+        accept_ready = true;
+        continue;
+      }
+      if (key == completions.getFd()) {
+        file_ready = true;
+        continue;
+      }
+      if (sessions_.get(key) != NULL && pending_.find(key) == pending_.end()) {
+        processSession(key);
+        if (sessions_.get(key) != NULL) {
+          updateTimer(key);
+        }
+      }
+    }
+
+    // continue sessions whose file I/O is done
+    if (file_ready) {
+      resumeFileSessions();
+    }
+
+    // wake sessions waiting for cgi worker released above
+    resumeCgiSessions();
+
+    // accept new connection after processing existing sessions
+    if (accept_ready || accept_pending_) {
+      acceptSessions();
+    }
+
+    // close connections making no progress too long
+    closeTimedOutSessions(time(NULL));
+  }
+}
@@ -0,0 +1,70 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Server.hpp                                         :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/03 13:05:27 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/27 15:12:40 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <time.h>
+
+#include <set>
+
+#include "Epoll.hpp"
+#include "Session.hpp"
+#include "SessionTable.hpp"
+#include "Socket.hpp"
+#include "TimerWheel.hpp"
+#include "config.hpp"
+
+/*
+** event loop of one worker
+**
+** each worker has its own listening socket (bound with SO_REUSEPORT),
+** epoll instance and sessions, so workers share nothing with each other
+*/
+
+class Server {
+ private:
+  int id_;                           // worker number (used in log)
+  Socket sock_;                      // socket for listening
+  Epoll epoll_;                      // epoll instance to wait for events
+  SessionTable sessions_;            // sessions (key is fd of socket)
+  std::set<int> pending_;            // sessions to process without waiting
+  TimerWheel timers_;                // timeouts of sessions
+  bool accept_pending_;              // connections left by ACCEPT_BATCH_MAX
+
+  // do not allow copy and assignation
+  Server(const Server& ref);
+  Server& operator=(const Server& ref);
+
+  void processSession(int key);
+  void closeSession(int key, int watched_fd);
+  void updateTimer(int key);
+  void acceptSessions();
+  void resumeCgiSessions();
+  void resumeFileSessions();
+  void closeTimedOutSessions(time_t now);
+
+ public:
+  Server();
+  ~Server();
+
+  // getter
+  int getId() const;
+
+  // function to init a worker
+  void init(int id, int port);
+
+  // main loop (never returns)
+  void run();
+};
+
+#endif /* SERVER_HPP */
@@ -6,459 +6,2412 @@
 /*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
 /*                                                +#+#+#+#+#+   +#+           */
 /*   Created: 2021/02/24 21:41:21 by dnakano           #+#    #+#             */
-/*   Updated: 2021/02/27 14:16:27 by dnakano          ###   ########.fr       */
+/*   Updated: 2021/03/28 19:05:00 by dnakano          ###   ########.fr       */
 /*                                                                            */
 /* ************************************************************************** */
 
 #include "Session.hpp"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>  // kill
+#include <stdio.h>   // snprintf
+#include <string.h>  // strlen
+#include <sys/ioctl.h>  // FIONREAD
+#include <sys/sendfile.h>
 #include <sys/socket.h>
-#include <sys/wait.h>  // waitpid
+#include <sys/uio.h>   // writev, preadv2
+#include <time.h>
 #include <unistd.h>
 
-#include <iostream>
+#include <algorithm>
+#include <deque>
 #include <string>
+#include <vector>
+
+#include "FileCache.hpp"
+#include "Logger.hpp"
+#include "Metrics.hpp"
+
+// content length of response whose body is streamed (not known in advance)
+#define STREAMED_LENGTH static_cast<size_t>(-1)
+
+/*
+** default constructor
+**
+** sessions are constructed only in SessionTable and reused by init()
+*/
+
+Session::Session()
+    : status_(SESSION_NOT_INIT),
+      sock_fd_(-1),
+      file_fd_(-1),
+      cgi_input_fd_(-1),
+      cgi_output_fd_(-1),
+      cgi_pid_(-1),
+      cgi_worker_(NULL),
+      cgi_out_sent_(0),
+      cgi_stdin_done_(false),
+      cgi_header_len_(0),
+      cgi_streaming_(false),
+      chunked_(false),
+      coding_(CODING_IDENTITY),
+      vary_(false),
+      body_streaming_(false),
+      body_idx_(0),
+      body_written_(0),
+      response_size_(0),
+      sent_bytes_(0),
+      file_job_start_(0),
+      abandoned_(false),
+      n_requests_(0),
+      keep_alive_(false),
+      last_active_(0),
+      header_start_(0),
+      retry_count_(0),
+      io_blocked_(false),
+      status_since_(0),
+      request_start_(0) {
+  timer_.prev = NULL;
+  timer_.next = NULL;
+  timer_.expire = 0;
+  timer_.key = -1;
+  uring_op_.key = -1;
+  uring_op_.opcode = 0;
+  uring_op_.pending = false;
+  uring_op_.done = false;
+  uring_op_.result = 0;
+}
+
+/*
+** destctor
+**
+** release data left (must not close fd, it is done by closeConnection)
+*/
+
+Session::~Session() { clear(); }
 
 /*
-** constructor
+** function: init
 **
-** initialize fd and status
+** initialize session for new connection of socket sock_fd
 **    - status is initialized SESSION_FOR_CLIENT_RECV first
 */
 
-Session::Session(int sock_fd)
-    : status_(SESSION_FOR_CLIENT_RECV), sock_fd_(sock_fd), retry_count_(0) {}
+void Session::init(int sock_fd) {
+  setStatus(SESSION_FOR_CLIENT_RECV);
+  sock_fd_ = sock_fd;
+  file_fd_ = -1;
+  cgi_input_fd_ = -1;
+  cgi_output_fd_ = -1;
+  cgi_pid_ = -1;
+  cgi_worker_ = NULL;
+  cgi_streaming_ = false;
+  chunked_ = false;
+  coding_ = CODING_IDENTITY;
+  vary_ = false;
+  parser_.reset(request_buf_.getEnd());
+  body_streaming_ = false;
+  head_.clear();
+  body_idx_ = 0;
+  body_written_ = 0;
+  sent_bytes_ = 0;
+  n_requests_ = 0;
+  keep_alive_ = false;
+  last_active_ = time(NULL);
+  header_start_ = last_active_;
+  retry_count_ = 0;
+  io_blocked_ = false;
+  abandoned_ = false;
+  timer_.key = sock_fd;
+  uring_op_.key = sock_fd;
+}
+
+/*
+** function: clear
+**
+** release memory and cache entries of session not used any more
+** (memory of containers is kept for next use, fds are not closed)
+*/
+
+void Session::clear() {
+  setStatus(SESSION_NOT_INIT);
+  request_buf_.clear();
+  requests_.clear();
+  body_buf_.clear();
+  clearSegments();
+}
+
+/*
+** getters
+*/
+
+const char* Session::getStatusName(SessionStatus status) {
+  switch (status) {
+    case SESSION_FOR_CLIENT_RECV:
+      return "client_recv";
+    case SESSION_FOR_CLIENT_SEND:
+      return "client_send";
+    case SESSION_FOR_CGI_WRITE:
+      return "cgi_write";
+    case SESSION_FOR_CGI_READ:
+      return "cgi_read";
+    case SESSION_FOR_FILE_WRITE:
+      return "file_write";
+    case SESSION_FOR_FILE_IO:
+      return "file_io";
+    default:
+      return NULL;  // not a status of session in use
+  }
+}
+
+SessionStatus Session::getStatus() const { return status_; }
+int Session::getSockFd() const { return sock_fd_; }
+int Session::getFileFd() const { return file_fd_; }
+int Session::getCgiFd() const {
+  if (cgi_worker_ != NULL) {
+    return cgi_worker_->fd;
+  }
+  return status_ == SESSION_FOR_CGI_WRITE ? cgi_input_fd_ : cgi_output_fd_;
+}
+bool Session::isIoBlocked() const { return io_blocked_; }
+bool Session::isIoSubmitted() const { return uring_op_.pending; }
+TimerNode* Session::getTimer() { return &timer_; }
+
+/*
+** function: setStatus
+**
+** change status and record time spent in previous status to metrics
+*/
+
+void Session::setStatus(SessionStatus status) {
+  if (status == status_) {
+    return;
+  }
+  Metrics& metrics = Metrics::getLocal();
+  unsigned long now = Metrics::getTimeUs();
+  if (status_ != SESSION_NOT_INIT) {
+    metrics.observeState(status_, now - status_since_);
+    metrics.addSessions(status_, -1);
+  }
+  if (status != SESSION_NOT_INIT) {
+    metrics.addSessions(status, 1);
+  }
+  status_ = status;
+  status_since_ = now;
+}
+
+/*
+** function: getDeadline
+**
+** returns time to close session if it makes no progress (or 0 if none)
+**    - TIMEOUT_FIRST_BYTE_SEC after accepted until first data received
+**    - KEEPALIVE_TIMEOUT_SEC while waiting for next request
+**    - TIMEOUT_HEADER_SEC after first byte of request until its headers
+**      are received (not extended by receiving data slowly)
+**    - TIMEOUT_BODY_SEC after last progress receiving body or sending
+**      (including body written to file as it is received)
+**    - TIMEOUT_CGI_SEC after last progress with cgi worker (including time
+**      waiting for an idle worker)
+**    - TIMEOUT_BODY_SEC after file I/O is submitted to FilePool (session
+**      is only abandoned then, see abandon)
+*/
+
+time_t Session::getDeadline() const {
+  switch (status_) {
+    case SESSION_FOR_CLIENT_RECV:
+      if (request_buf_.empty()) {
+        return last_active_ + (n_requests_ == 0 ? TIMEOUT_FIRST_BYTE_SEC
+                                                : KEEPALIVE_TIMEOUT_SEC);
+      } else if (parser_.getState() < PARSE_BODY) {
+        return header_start_ + TIMEOUT_HEADER_SEC;
+      }
+      return last_active_ + TIMEOUT_BODY_SEC;
+    case SESSION_FOR_CLIENT_SEND:
+      return last_active_ + TIMEOUT_BODY_SEC;
+    case SESSION_FOR_CGI_WRITE:
+    case SESSION_FOR_CGI_READ:
+      return last_active_ + TIMEOUT_CGI_SEC;
+    case SESSION_FOR_FILE_WRITE:
+      return body_streaming_ ? last_active_ + TIMEOUT_BODY_SEC : 0;
+    case SESSION_FOR_FILE_IO:
+      return abandoned_ ? 0 : file_job_start_ + TIMEOUT_BODY_SEC;
+    default:
+      return 0;  // retrying to write to file
+  }
+}
+
+/*
+** function: isWouldBlock
+**
+** check if failed I/O is only because fd is not ready (not a real failure)
+** callers set io_blocked_ so that edge triggered loop can stop calling them
+*/
+
+static bool isWouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+
+/*
+** function: isPageCached
+**
+** returns whether len bytes of file at offset are in page cache, so that
+** sendfile does not wait for disk
+**    - best effort: only first and last bytes are checked (pages between
+**      are likely cached with them as files are read ahead, but sendfile
+**      may still wait for disk if not)
+*/
+
+static bool isPageCached(int fd, off_t offset, size_t len) {
+  char c;
+  struct iovec iov;
+  off_t last = offset + static_cast<off_t>(len) - 1;
+
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  if (preadv2(fd, &iov, 1, offset, RWF_NOWAIT) == -1 && errno == EAGAIN) {
+    return false;
+  }
+  return last == offset || preadv2(fd, &iov, 1, last, RWF_NOWAIT) != -1 ||
+         errno != EAGAIN;
+}
+
+/*
+** function: getReadableSize
+**
+** returns bytes readable now from pipe or socket fd (0 if none or error)
+*/
+
+static size_t getReadableSize(int fd) {
+  int avail = 0;
+
+  if (ioctl(fd, FIONREAD, &avail) == -1 || avail < 0) {
+    return 0;
+  }
+  return avail;
+}
+
+/*
+** function: isCgiTarget
+**
+** check if target (without query) is to run cgi script or cgi worker
+*/
+
+static bool isCgiTarget(const std::string& target) {
+  return !target.compare(0, strlen(CGI_SCRIPT_PREFIX), CGI_SCRIPT_PREFIX) ||
+         !target.compare(0, strlen(CGI_PATH_PREFIX), CGI_PATH_PREFIX);
+}
+
+/*
+** function: isUploadTarget
+**
+** check if target (without query) is a file directly in UPLOAD_DIR, the
+** only place PUT and POST may write to
+*/
+
+static bool isUploadTarget(const std::string& target) {
+  size_t len = strlen(UPLOAD_DIR);
+
+  return target.size() > len && !target.compare(0, len, UPLOAD_DIR) &&
+         target.find('/', len) == std::string::npos;
+}
+
+/*
+** function: isUploadTemp
+**
+** check if target is named as temporary file of upload
+** (".<name>" + UPLOAD_TEMP_SUFFIX + 6 characters, see FilePool::process)
+*/
+
+static bool isUploadTemp(const std::string& target) {
+  size_t name_pos = target.rfind('/') + 1;
+  size_t len = strlen(UPLOAD_TEMP_SUFFIX);
+
+  return target.size() >= name_pos + 1 + len + 6 &&
+         target[name_pos] == '.' &&
+         !target.compare(target.size() - 6 - len, len, UPLOAD_TEMP_SUFFIX);
+}
+
+/*
+** function: recvReq
+**
+** receive request from client
+**    - recv is submitted to io_uring if it is used, and request is
+**      processed when called again after its completion
+**    - session abandoned is closed when its recv is completed
+*/
+
+int Session::recvReq() {
+  ssize_t n;
+  size_t len;
+
+  io_blocked_ = false;
+  if (uring_op_.pending) {
+    return 0;
+  } else if (uring_op_.done) {
+    n = takeIoResult();
+    if (abandoned_) {
+      closeConnection();
+      return -1;
+    }
+  } else {
+    char* buf = request_buf_.prepareWrite(&len);  // receive directly in it
+    Epoll* epoll = Epoll::getLocal();
+    if (epoll != NULL &&
+        epoll->submitRecv(sock_fd_, buf, len, &uring_op_) == 0) {
+      return 0;
+    }
+    n = recv(sock_fd_, buf, len, 0);
+  }
+  if (n == -1) {
+    if (isWouldBlock()) {
+      io_blocked_ = true;
+      return 0;
+    }
+    if (retry_count_ == RETRY_TIME_MAX) {
+      close(sock_fd_);
+      return -1;  // return -1 if error (this session will be closed)
+    }
+    retry_count_++;
+    return 0;
+  }
+  if (n == 0) {  // connection closed by client
+    close(sock_fd_);
+    return -1;
+  }
+  retry_count_ = 0;
+  last_active_ = time(NULL);
+  if (request_buf_.empty()) {
+    header_start_ = last_active_;  // first byte of next request
+  }
+  request_buf_.commitWrite(n);
+
+  // start processing if one or more requests are received
+  parseRequests();
+  if (requests_.empty()) {
+    return 0;
+  }
+  setStatus(processRequests());
+  return 1;
+}
+
+/*
+** function: parseRequests
+**
+** parse received data (continues from where parsed last time)
+** and queue all requests received completely (pipelining)
+**    - a request failed to parse is also queued to respond error in order
+**      but no more request is parsed after it
+**    - request line and headers are kept contiguous in buffer while parsing
+**      (parser and requests refer to them in place)
+**    - request to cgi whose body is being received is queued when it is the
+**      next to process, and its body is parsed in place as it is received
+**      (see recvBody)
+*/
+
+void Session::parseRequests() {
+  if (body_streaming_) {
+    ParseStatus ret = requests_.front().parse(request_buf_);
+    if (ret == PARSE_AGAIN) {
+      return;
+    }
+    body_streaming_ = false;
+    parser_ = requests_.front();
+    if (ret == PARSE_ERROR) {
+      return;
+    }
+    parser_.reset(parser_.getEnd());
+    header_start_ = last_active_;
+  }
+  while (requests_.size() < PIPELINE_REQUEST_MAX && parser_.getError() == 0) {
+    if (parser_.getState() < PARSE_BODY) {
+      request_buf_.makeContiguous(parser_.getStart());
+    }
+    ParseStatus ret = parser_.parse(request_buf_);
+    if (ret == PARSE_AGAIN) {
+      if (requests_.empty() && isBodyStreamable(parser_)) {
+        requests_.push_back(parser_);
+        body_streaming_ = true;
+      }
+      return;
+    }
+    requests_.push_back(parser_);
+    if (ret == PARSE_ERROR) {
+      return;
+    }
+    parser_.reset(parser_.getEnd());
+    header_start_ = last_active_;
+  }
+}
+
+/*
+** function: isBodyStreamable
+**
+** check if body of request being received can be written as it is received
+**    - body of Content-Length to cgi (not chunked because its length must
+**      be passed to cgi first)
+**    - any body to file (written to temporary file, see createResponse)
+*/
+
+bool Session::isBodyStreamable(const HttpRequest& request) const {
+  if (request.getState() < PARSE_BODY) {
+    return false;
+  }
+  const char* buf = getRequestHead(request);
+  std::string target = HttpRequest::toString(buf, request.getTarget());
+  if (isCgiTarget(target)) {
+    return request.getState() == PARSE_BODY;
+  }
+  return HttpRequest::equals(buf, request.getMethod(), "PUT") ||
+         HttpRequest::equals(buf, request.getMethod(), "POST");
+}
+
+/*
+** function: isKeepAlive
+**
+** check if connection should be kept after sending response of request
+**    - HTTP/1.1 keeps connection unless "Connection: close"
+**    - HTTP/1.0 keeps connection only if "Connection: keep-alive"
+**    - closed when number of requests reached KEEPALIVE_REQUEST_MAX
+*/
+
+bool Session::isKeepAlive(const HttpRequest& request) const {
+  const char* buf = getRequestHead(request);
+  const HttpRequest::View* connection = request.findHeader(buf, "Connection");
+
+  if (request.getError() != 0 || n_requests_ >= KEEPALIVE_REQUEST_MAX) {
+    return false;
+  } else if (request.getVersionMinor() == 0) {
+    return connection && HttpRequest::hasToken(buf, *connection, "keep-alive");
+  }
+  return !connection || !HttpRequest::hasToken(buf, *connection, "close");
+}
+
+/*
+** function: getAcceptedCoding
+**
+** returns content coding of response accepted by client of request
+*/
+
+ContentCoding Session::getAcceptedCoding(const HttpRequest& request) const {
+  const char* buf = getRequestHead(request);
+  const HttpRequest::View* accept = request.findHeader(buf, "Accept-Encoding");
+
+  if (accept == NULL) {
+    return CODING_IDENTITY;
+  }
+  return selectContentCoding(buf + accept->off, accept->len);
+}
+
+/*
+** function: getRequestHead
+**
+** returns pointer to request line and headers of request in buffer
+** (or in head_ if they are released from buffer, see releaseBody)
+*/
+
+const char* Session::getRequestHead(const HttpRequest& request) const {
+  size_t len;
+
+  if (request.getStart() < request_buf_.getBegin()) {
+    return head_.data();
+  }
+  return request_buf_.peek(request.getStart(), &len);
+}
+
+/*
+** function: processRequests
+**
+** process queued requests in order and returns next status of session
+**    - requests responded without waiting (e.g. error) are processed
+**      one after another and their responses are appended to response_buf_
+**    - stops at a request waiting for file or cgi, and when responses
+**      reach PIPELINE_FLUSH_SIZE (responses ready are sent at once)
+*/
+
+SessionStatus Session::processRequests() {
+  while (!requests_.empty() && response_size_ < PIPELINE_FLUSH_SIZE) {
+    SessionStatus status = startRequest();
+    if (status != SESSION_FOR_CLIENT_SEND) {
+      return status;  // wait for file or cgi
+    }
+    finishRequest();
+  }
+  if (!segments_.empty()) {
+    return SESSION_FOR_CLIENT_SEND;
+  }
+  return SESSION_FOR_CLIENT_RECV;
+}
+
+/*
+** function: startRequest
+**
+** start processing the first request in queue
+** returns SESSION_FOR_CLIENT_SEND if its response is already made
+*/
+
+SessionStatus Session::startRequest() {
+  const HttpRequest& request = requests_.front();
+
+  ++n_requests_;
+  request_start_ = Metrics::getTimeUs();
+  Metrics::getLocal().add(METRIC_REQUESTS, 1);
+  keep_alive_ = isKeepAlive(request);
+  body_idx_ = 0;
+  body_written_ = 0;
+  body_buf_.clear();
+  file_fd_ = -1;
+  cgi_streaming_ = false;
+  chunked_ = false;
+  coding_ = CODING_IDENTITY;
+  vary_ = false;
+  deflater_.end();
+  headers_.clear();
+  if (request.getError() != 0) {
+    setErrorResponse(request.getError());
+    return SESSION_FOR_CLIENT_SEND;
+  }
+  return createResponse();
+}
+
+/*
+** function: finishRequest
+**
+** remove the first request from queue after its response is made
+**    - time to make response is observed now, and duration of request
+**      when its last byte is sent (see observeSent)
+**    - requests after "Connection: close" are discarded
+**    - received data is removed from buffer when no request refers to it
+**      (offsets in buffer are not changed by removing)
+*/
+
+void Session::finishRequest() {
+  ResponseEnd response_end;
+
+  Metrics::getLocal().observeBuild(Metrics::getTimeUs() - request_start_);
+  response_end.end = sent_bytes_ + response_size_;
+  response_end.request_start = request_start_;
+  response_ends_.push_back(response_end);
+  requests_.pop_front();
+  if (!keep_alive_) {
+    requests_.clear();
+    body_streaming_ = false;
+    return;
+  }
+  if (requests_.empty()) {
+    request_buf_.consumeTo(parser_.getStart());
+    parseRequests();  // resume if stopped by PIPELINE_REQUEST_MAX
+  }
+}
+
+/*
+** function: completeRequest
+**
+** make response of the first request and go to next request
+** (called when processing with file or cgi is finished)
+*/
+
+void Session::completeRequest(int http_status) {
+  setResponse(http_status);
+  finishRequest();
+  setStatus(processRequests());
+}
+
+/*
+** function: failRequest
+**
+** make error response of the first request and go to next request
+*/
+
+void Session::failRequest(int http_status) {
+  setErrorResponse(http_status);
+  finishRequest();
+  setStatus(processRequests());
+}
+
+/*
+** function: sendRes
+**
+** send all responses ready in segments_ to client
+**    - segments in memory are sent at once by writev (no data is copied
+**      to join status line, headers and body)
+**    - segment of file is sent by sendfile, segment of pipe by splice
+**    - segment of file not in page cache is sent by FilePool (page cache
+**      is checked once for each segment, not for each sendfile)
+**    - output of cgi streamed is read again when all of it is sent
+**    - if io_uring is used, writev is submitted to it as sendmsg, and
+**      segment of file not in page cache is read to file_buf_ by it and
+**      then sent (instead of FilePool), see finishSendOp
+*/
+
+int Session::sendRes() {
+  const ResponseSegment& front = segments_.front();
+  Epoll* epoll = Epoll::getLocal();
+  ssize_t n;
+
+  io_blocked_ = false;
+  if (uring_op_.pending) {
+    return 0;
+  } else if (uring_op_.done) {
+    return finishSendOp();
+  }
+  if (!file_buf_.empty()) {  // head of front segment read by io_uring
+    int n_iov = file_buf_.getIovec(file_buf_.getBegin(), file_buf_.size(),
+                                   uring_op_.iov, IOBUF_IOV_MAX);
+    if (epoll != NULL && epoll->submitSend(sock_fd_, n_iov, &uring_op_) == 0) {
+      return 0;
+    }
+    n = writev(sock_fd_, uring_op_.iov, n_iov);
+    if (n > 0) {
+      file_buf_.consume(n);
+    }
+  } else if (front.fd >= 0 && front.offset < 0) {
+    n = splice(front.fd, NULL, sock_fd_, NULL, front.len,
+               SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+  } else if (front.fd >= 0) {
+    size_t len = std::min(front.len, static_cast<size_t>(SENDFILE_MAX));
+    if (!front.cached && !isPageCached(front.fd, front.offset, front.len)) {
+      if (epoll != NULL && epoll->isUring()) {
+        int n_iov = file_buf_.prepareWritev(len, uring_op_.iov, IOBUF_IOV_MAX);
+        if (epoll->submitRead(front.fd, front.offset, n_iov, &uring_op_) == 0) {
+          return 0;
+        }
+        file_buf_.commitWritev(0);
+      }
+      file_job_.fd = front.fd;
+      file_job_.sock_fd = sock_fd_;
+      file_job_.offset = front.offset;
+      file_job_.len = len;
+      startFileJob(FILE_JOB_SENDFILE);  // would wait for disk
+      setStatus(SESSION_FOR_FILE_IO);
+      return 0;
+    }
+    segments_.front().cached = true;
+    off_t offset = front.offset;
+    n = sendfile(sock_fd_, front.fd, &offset, len);
+  } else {
+    struct iovec* iov = uring_op_.iov;
+    int n_iov = 0;
+    size_t buf_off = response_buf_.getBegin();
+    for (std::deque<ResponseSegment>::const_iterator itr = segments_.begin();
+         itr != segments_.end() && itr->fd < 0 && n_iov < IOBUF_IOV_MAX;
+         ++itr) {
+      if (itr->data != NULL) {
+        iov[n_iov].iov_base = const_cast<char*>(itr->data);
+        iov[n_iov].iov_len = itr->len;
+        ++n_iov;
+      } else {
+        n_iov += response_buf_.getIovec(buf_off, itr->len, iov + n_iov,
+                                        IOBUF_IOV_MAX - n_iov);
+        buf_off += itr->len;
+      }
+    }
+    if (epoll != NULL && epoll->submitSend(sock_fd_, n_iov, &uring_op_) == 0) {
+      return 0;
+    }
+    n = writev(sock_fd_, iov, n_iov);
+  }
+  return finishSend(n);
+}
+
+/*
+** function: takeIoResult
+**
+** returns result of I/O completed by io_uring as its system call does
+** (-1 and errno is set if failed)
+*/
+
+ssize_t Session::takeIoResult() {
+  uring_op_.done = false;
+  if (uring_op_.result < 0) {
+    errno = -uring_op_.result;
+    return -1;
+  }
+  return uring_op_.result;
+}
+
+/*
+** function: finishSendOp
+**
+** continue with result of I/O submitted to io_uring by sendRes
+**    - data read from file is sent next (end of file or failure to read
+**      before Content-Length is sent closes connection)
+**    - data sent from file_buf_ is removed from it
+**    - session abandoned is closed
+*/
+
+int Session::finishSendOp() {
+  ssize_t n = takeIoResult();
+
+  if (abandoned_) {
+    closeConnection();
+    return -1;
+  }
+  if (uring_op_.opcode == IORING_OP_READV) {
+    file_buf_.commitWritev(n > 0 ? n : 0);
+    if (n == -1) {
+      LOG_ERROR("failed to read file to send");
+      closeConnection();
+      return -1;
+    }
+    return n == 0 ? finishSend(0) : 0;  // (0 means file truncated)
+  }
+  if (!file_buf_.empty() && n > 0) {
+    file_buf_.consume(n);
+  }
+  return finishSend(n);
+}
+
+/*
+** function: finishSend
+**
+** update segments_ and status after n bytes of response are sent
+** (n is -1 and errno is set if failed)
+*/
+
+int Session::finishSend(ssize_t n) {
+  if (n == -1) {
+    if (isWouldBlock()) {
+      io_blocked_ = true;
+      return 0;
+    }
+    LOG_ERROR("failed to send response");
+    if (retry_count_ == RETRY_TIME_MAX) {
+      LOG_ERROR("close connection");
+      closeConnection();
+      return -1;  // return -1 if error (this session will be closed)
+    }
+    retry_count_++;
+    return 0;
+  }
+  retry_count_ = 0;  // reset retry_count if success
+  last_active_ = time(NULL);
+
+  if (n == 0 && segments_.front().fd >= 0) {
+    // file got shorter than Content-Length, cannot continue on this connection
+    LOG_ERROR("file truncated while sending");
+    closeConnection();
+    return -1;
+  }
+  advanceSegments(n);  // remove data already sent
+  Metrics::getLocal().add(METRIC_BYTES_SENT, n);
+  observeSent();
+
+  if (segments_.empty()) {
+    if (cgi_streaming_) {
+      setStatus(SESSION_FOR_CGI_READ);  // client took all output so far
+      return 0;
+    }
+    if (!keep_alive_) {
+      close(sock_fd_);
+      return 1;  // return 1 if all data sent (this session will be closed)
+    }
+    setStatus(processRequests());  // continue with queued requests
+  }
+  return 0;
+}
+
+/*
+** function: setResponse
+**
+** append http response with body_buf_ as body to response_buf_
+** (body is compressed if coding_ is set)
+*/
+
+void Session::setResponse(int http_status) {
+  if (coding_ != CODING_IDENTITY) {
+    compressBody();
+  }
+  appendResponseHeader(http_status, body_buf_.size());
+  appendBufferSegment(body_buf_);
+}
+
+/*
+** function: respondFile
+**
+** append response of file in entry acquired (in coding) or error response
+** if it is NULL (by errno)
+**    - small file is sent from content in cache
+**    - others are sent from fd in cache by sendfile
+**    - entry of cache is kept until body is sent
+*/
+
+SessionStatus Session::respondFile(FileCache::Entry* entry,
+                                   ContentCoding coding) {
+  if (entry == NULL) {
+    setErrorResponse(errno == ENOENT ? HTTP_404 : HTTP_403);
+    return SESSION_FOR_CLIENT_SEND;
+  }
+  coding_ = coding;
+  vary_ = Deflater::isCompressible(filename_) &&
+          (coding != CODING_IDENTITY || entry->st.st_size >= COMPRESS_MIN_SIZE);
+  setFileResponse(entry);
+  return SESSION_FOR_CLIENT_SEND;
+}
+
+/*
+** function: setFileResponse
+**
+** append response of file in cache entry (whole or ranges by Range)
+**    - each range is sent from content in cache or from fd by sendfile
+**      at its offset (nothing is read or copied)
+**    - more than one range is sent as multipart/byteranges
+**    - Range is ignored if If-Range does not match, it is broken or it has
+**      more than RANGE_MAX ranges
+*/
+
+void Session::setFileResponse(FileCache::Entry* entry) {
+  const HttpRequest& request = requests_.front();
+  const char* buf = getRequestHead(request);
+  const HttpRequest::View* range = request.findHeader(buf, "Range");
+  off_t size = entry->st.st_size;
+  std::vector<ByteRange> ranges;
+  char line[96];
+  int n;
+
+  // (headers_ is built in place to reuse its capacity)
+  if (range == NULL || !isRangeFresh(entry) ||
+      parseRange(buf + range->off, range->len, size, &ranges) == -1 ||
+      ranges.size() > RANGE_MAX) {
+    headers_.assign("Accept-Ranges: bytes\r\nETag: ");
+    headers_.append(entry->etag);
+    headers_.append("\r\nLast-Modified: ");
+    headers_.append(entry->last_modified);
+    headers_.append("\r\n");
+    appendResponseHeader(HTTP_200, size);
+    appendFileBody(entry, 0, size);
+    return;
+  } else if (ranges.empty()) {
+    FileCache::getInstance().release(entry);
+    n = snprintf(line, sizeof(line), "Content-Range: bytes */%lld\r\n",
+                 static_cast<long long>(size));
+    headers_.assign(line, n);
+    setErrorResponse(HTTP_416);
+    return;
+  }
+  headers_.assign("ETag: ");
+  headers_.append(entry->etag);
+  headers_.append("\r\n");
+
+  // single range
+  if (ranges.size() == 1) {
+    n = snprintf(line, sizeof(line), "Content-Range: bytes %lld-%lld/%lld\r\n",
+                 static_cast<long long>(ranges[0].first),
+                 static_cast<long long>(ranges[0].last),
+                 static_cast<long long>(size));
+    headers_.append(line, n);
+    size_t len = ranges[0].last - ranges[0].first + 1;
+    appendResponseHeader(HTTP_206, len);
+    appendFileBody(entry, ranges[0].first, len);
+    return;
+  }
+
+  // multipart (headers of parts are made first to know Content-Length)
+  char boundary[32];
+  snprintf(boundary, sizeof(boundary), "%08lx%08x%04x",
+           static_cast<unsigned long>(last_active_),
+           static_cast<unsigned int>(sock_fd_), n_requests_ & 0xffff);
+  std::vector<std::string> parts(ranges.size());
+  size_t length = 0;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    n = snprintf(line, sizeof(line),
+                 "\r\n--%s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                 boundary, static_cast<long long>(ranges[i].first),
+                 static_cast<long long>(ranges[i].last),
+                 static_cast<long long>(size));
+    parts[i].assign(line, n);
+    length += parts[i].size() + (ranges[i].last - ranges[i].first + 1);
+  }
+  std::string close_delimiter = std::string("\r\n--") + boundary + "--\r\n";
+  headers_.append("Content-Type: multipart/byteranges; boundary=");
+  headers_.append(boundary);
+  headers_.append("\r\n");
+  appendResponseHeader(HTTP_206, length + close_delimiter.size());
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    if (i > 0) {
+      FileCache::getInstance().retain(entry);  // released by each segment
+    }
+    appendCopySegment(parts[i].data(), parts[i].size());
+    appendFileBody(entry, ranges[i].first,
+                   ranges[i].last - ranges[i].first + 1);
+  }
+  appendCopySegment(close_delimiter.data(), close_delimiter.size());
+}
+
+/*
+** function: isRangeFresh
+**
+** check if If-Range (if any) matches file of entry, so that ranges of it
+** can be sent (validator is compared as is, weak ETag never matches)
+*/
+
+bool Session::isRangeFresh(const FileCache::Entry* entry) const {
+  const HttpRequest& request = requests_.front();
+  const char* buf = getRequestHead(request);
+  const HttpRequest::View* if_range = request.findHeader(buf, "If-Range");
+
+  if (if_range == NULL) {
+    return true;
+  }
+  std::string validator = HttpRequest::toString(buf, *if_range);
+  return validator == entry->etag || validator == entry->last_modified;
+}
+
+/*
+** function: appendFileBody
+**
+** append len bytes from offset of file in entry to segments_
+** (one reference of entry is released when they are sent)
+*/
+
+void Session::appendFileBody(FileCache::Entry* entry, off_t offset,
+                             size_t len) {
+  if (entry->has_content) {
+    appendSegment(entry->content.data() + offset, len, entry);
+  } else {
+    appendFileSegment(entry, offset, len);
+  }
+}
+
+/*
+** function: compressBody
+**
+** compress whole body_buf_ in coding_
+** (sent as is if smaller than COMPRESS_MIN_SIZE or compression failed)
+*/
+
+void Session::compressBody() {
+  IoBuffer compressed;
+
+  if (body_buf_.size() < COMPRESS_MIN_SIZE ||
+      deflater_.start(coding_, COMPRESS_STREAM_LEVEL) == -1) {
+    coding_ = CODING_IDENTITY;
+    return;
+  }
+  int ret = deflater_.compress(&body_buf_, &compressed, Z_FINISH);
+  deflater_.end();
+  if (ret == -1) {
+    LOG_ERROR("failed to compress response");
+    coding_ = CODING_IDENTITY;  // body_buf_ is left as is
+    return;
+  }
+  body_buf_.clear();
+  body_buf_.appendBuffer(compressed);
+}
+
+/*
+** function: appendResponseHeader
+**
+** append status line and headers of response to segments_
+**    - status line is static data (not copied)
+**    - header fields are copied to the end of response_buf_ one by one
+**      (joined in one segment, nothing is allocated for them)
+**    - body of STREAMED_LENGTH is sent chunked if chunked_ is set, or
+**      ends by closing connection
+*/
+
+void Session::appendResponseHeader(int http_status, size_t content_length) {
+  const char* status_line = getStatusLine(http_status);
+  char line[48];
+
+  logAccess(http_status, content_length);
+  if (http_status >= 200 && http_status < 600) {
+    int status_class = http_status / 100;
+    Metrics::getLocal().add(
+        static_cast<MetricCounter>(METRIC_RESPONSES_2XX + status_class - 2), 1);
+  }
+
+  if (body_streaming_) {
+    keep_alive_ = false;  // rest of body is not received
+  }
+  appendSegment(status_line, strlen(status_line), NULL);
+  if (content_length != STREAMED_LENGTH) {
+    int n = snprintf(line, sizeof(line), "Content-Length: %lu\r\n",
+                     static_cast<unsigned long>(content_length));
+    appendCopySegment(line, n);
+  } else if (chunked_) {
+    appendCopySegment("Transfer-Encoding: chunked\r\n");
+  }
+  if (coding_ != CODING_IDENTITY) {
+    appendCopySegment("Content-Encoding: ");
+    appendCopySegment(getContentCodingName(coding_));
+    appendCopySegment("\r\n");
+  }
+  if (vary_) {
+    appendCopySegment("Vary: Accept-Encoding\r\n");
+  }
+  appendCopySegment(headers_.data(), headers_.size());
+  if (!keep_alive_) {
+    appendCopySegment("Connection: close\r\n");
+  } else if (requests_.front().getVersionMinor() == 0) {
+    appendCopySegment("Connection: keep-alive\r\n");
+  }
+  appendCopySegment("\r\n");
+}
+
+/*
+** function: logAccess
+**
+** log method, target, status and body length of response of request
+** (compiled out if LOG_LEVEL is over info)
+*/
+
+void Session::logAccess(int http_status, size_t content_length) const {
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+  const HttpRequest& request = requests_.front();
+  const char* head = getRequestHead(request);
+  HttpRequest::View method = request.getMethod();
+  HttpRequest::View target = request.getTarget();
+  LogRecord record(LOG_LEVEL_INFO);
+
+  if (head == NULL || method.len == 0 || target.len == 0) {
+    record << "- - ";  // failed to parse
+  } else {
+    record.append(head + method.off, method.len) << ' ';
+    record.append(head + target.off, target.len) << ' ';
+  }
+  record << http_status << ' ';
+  if (content_length == STREAMED_LENGTH) {
+    record << '-';
+  } else {
+    record << content_length;
+  }
+#else
+  (void)http_status;
+  (void)content_length;
+#endif
+}
+
+/*
+** function: appendSegment
+**
+** append data in memory to segments_ (data must live until sent)
+**    - entry of file cache owning data is released when data is sent
+*/
+
+void Session::appendSegment(const char* data, size_t len,
+                            FileCache::Entry* entry) {
+  ResponseSegment segment;
+
+  if (len == 0) {
+    if (entry != NULL) {
+      FileCache::getInstance().release(entry);
+    }
+    return;
+  }
+  segment.data = data;
+  segment.fd = -1;
+  segment.offset = 0;
+  segment.len = len;
+  segment.entry = entry;
+  segment.cached = false;
+  segments_.push_back(segment);
+  response_size_ += len;
+}
+
+/*
+** function: appendFileSegment
+**
+** append region of file in cache to segments_ (sent by sendfile)
+*/
+
+void Session::appendFileSegment(FileCache::Entry* entry, off_t offset,
+                                size_t len) {
+  ResponseSegment segment;
+
+  if (len == 0) {
+    FileCache::getInstance().release(entry);
+    return;
+  }
+  segment.data = NULL;
+  segment.fd = entry->fd;
+  segment.offset = offset;
+  segment.len = len;
+  segment.entry = entry;
+  segment.cached = false;
+  segments_.push_back(segment);
+  response_size_ += len;
+}
+
+/*
+** function: appendBufferSegment
+**
+** move all data of buf to response_buf_ and append it to segments_
+** (blocks of buf are moved, not copied)
+*/
+
+void Session::appendBufferSegment(IoBuffer& buf) {
+  size_t len = buf.size();
+
+  if (len == 0) {
+    return;
+  }
+  response_buf_.appendBuffer(buf);
+  response_size_ += len;
+  if (!segments_.empty() && segments_.back().data == NULL &&
+      segments_.back().fd < 0) {
+    segments_.back().len += len;  // continues from last segment in buffer
+    return;
+  }
+  ResponseSegment segment;
+  segment.data = NULL;
+  segment.fd = -1;
+  segment.offset = 0;
+  segment.len = len;
+  segment.entry = NULL;
+  segment.cached = false;
+  segments_.push_back(segment);
+}
+
+/*
+** function: appendCopySegment
+**
+** copy small data (e.g. size line of chunk) to the end of response_buf_
+** and append it to segments_ (no block is allocated for it if last one
+** has space)
+*/
+
+void Session::appendCopySegment(const char* str) {
+  appendCopySegment(str, strlen(str));
+}
+
+void Session::appendCopySegment(const char* data, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  response_buf_.append(data, len);
+  response_size_ += len;
+  if (!segments_.empty() && segments_.back().data == NULL &&
+      segments_.back().fd < 0) {
+    segments_.back().len += len;  // continues from last segment in buffer
+    return;
+  }
+  ResponseSegment segment;
+  segment.data = NULL;
+  segment.fd = -1;
+  segment.offset = 0;
+  segment.len = len;
+  segment.entry = NULL;
+  segment.cached = false;
+  segments_.push_back(segment);
+}
+
+/*
+** function: appendPipeSegment
+**
+** append len bytes readable in pipe fd to segments_ (sent by splice, data
+** is not read to memory)
+*/
+
+void Session::appendPipeSegment(int fd, size_t len) {
+  ResponseSegment segment;
+
+  segment.data = NULL;
+  segment.fd = fd;
+  segment.offset = -1;
+  segment.len = len;
+  segment.entry = NULL;
+  segment.cached = false;
+  segments_.push_back(segment);
+  response_size_ += len;
+}
+
+/*
+** function: startStreamResponse
+**
+** append status line and headers of response whose body is streamed
+** (its length is not known in advance)
+**    - body is chunked for HTTP/1.1, or ends by closing connection for
+**      HTTP/1.0
+*/
+
+void Session::startStreamResponse(int http_status) {
+  chunked_ = requests_.front().getVersionMinor() > 0;
+  if (!chunked_) {
+    keep_alive_ = false;
+  }
+  appendResponseHeader(http_status, STREAMED_LENGTH);
+}
+
+/*
+** function: appendChunk
+**
+** move data to segments_ as a chunk of body streamed (as is if not chunked)
+**    - framed in place: only size line is copied (to the end of
+**      response_buf_), blocks of data are moved and CRLF is static
+**    - data is compressed first while deflater_ is active (flushed, so that
+**      client can decode all data sent so far)
+**    - empty data is not appended (it would be the last chunk)
+**    - returns -1 if compression failed (nothing is appended, response
+**      cannot be completed)
+*/
+
+int Session::appendChunk(IoBuffer& data) {
+  IoBuffer compressed;
+  IoBuffer* chunk = &data;
+
+  if (deflater_.isActive() && !data.empty()) {
+    if (deflater_.compress(&data, &compressed, Z_SYNC_FLUSH) == -1) {
+      LOG_ERROR("failed to compress response");
+      return -1;
+    }
+    chunk = &compressed;
+  }
+  if (chunk->empty()) {
+    return 0;
+  } else if (chunked_) {
+    appendChunkSize(chunk->size());
+  }
+  appendBufferSegment(*chunk);
+  if (chunked_) {
+    appendSegment("\r\n", 2, NULL);
+  }
+  return 0;
+}
+
+/*
+** function: appendPipeChunk
+**
+** append len bytes readable in pipe fd as a chunk of body streamed
+** (data is sent by splice, see appendPipeSegment)
+*/
+
+void Session::appendPipeChunk(int fd, size_t len) {
+  if (chunked_) {
+    appendChunkSize(len);
+  }
+  appendPipeSegment(fd, len);
+  if (chunked_) {
+    appendSegment("\r\n", 2, NULL);
+  }
+}
+
+/*
+** function: appendChunkSize
+**
+** append size line of chunk of len bytes to segments_
+*/
+
+void Session::appendChunkSize(size_t len) {
+  char line[24];
+  int n = snprintf(line, sizeof(line), "%lx\r\n",
+                   static_cast<unsigned long>(len));
+
+  appendCopySegment(line, n);
+}
+
+/*
+** function: appendLastChunk
+**
+** append end of body streamed (nothing if not chunked, connection is
+** closed after it)
+**    - end of compressed data is appended first if deflater_ is active
+**    - returns -1 if compression failed (last chunk is not appended)
+*/
+
+int Session::appendLastChunk() {
+  if (deflater_.isActive()) {
+    IoBuffer rest;
+    int ret = deflater_.compress(NULL, 0, &rest, Z_FINISH);
+    deflater_.end();
+    if (ret == -1) {
+      LOG_ERROR("failed to compress response");
+      return -1;
+    }
+    appendChunk(rest);
+  }
+  if (chunked_) {
+    appendSegment("0\r\n\r\n", 5, NULL);
+  }
+  return 0;
+}
+
+/*
+** function: advanceSegments
+**
+** remove n bytes sent from head of segments_ (partial write is continued
+** from the middle of segment next time)
+*/
+
+void Session::advanceSegments(size_t n) {
+  response_size_ -= n;
+  sent_bytes_ += n;
+  while (n > 0) {
+    ResponseSegment& segment = segments_.front();
+    size_t len = std::min(n, segment.len);
+    if (segment.data != NULL) {
+      segment.data += len;
+    } else if (segment.fd < 0) {
+      response_buf_.consume(len);
+    } else if (segment.offset >= 0) {
+      segment.offset += len;  // (pipe has no offset)
+    }
+    segment.len -= len;
+    n -= len;
+    if (segment.len == 0) {
+      if (segment.entry != NULL) {
+        FileCache::getInstance().release(segment.entry);
+      }
+      segments_.pop_front();
+    }
+  }
+}
+
+/*
+** function: observeSent
+**
+** observe duration of requests whose response is sent to the last byte
+** (a response discarded is not observed)
+*/
+
+void Session::observeSent() {
+  unsigned long now = 0;
+
+  while (!response_ends_.empty() && response_ends_.front().end <= sent_bytes_) {
+    if (now == 0) {
+      now = Metrics::getTimeUs();
+    }
+    Metrics::getLocal().observeRequest(now -
+                                       response_ends_.front().request_start);
+    response_ends_.pop_front();
+  }
+}
+
+/*
+** function: clearSegments
+**
+** discard all responses not sent
+*/
+
+void Session::clearSegments() {
+  while (!segments_.empty()) {
+    if (segments_.front().entry != NULL) {
+      FileCache::getInstance().release(segments_.front().entry);
+    }
+    segments_.pop_front();
+  }
+  response_buf_.clear();
+  file_buf_.clear();
+  response_size_ = 0;
+  response_ends_.clear();
+}
+
+/*
+** function: setErrorResponse
+**
+** append error response to response_buf_
+*/
+
+void Session::setErrorResponse(int http_status) {
+  char body[64];
+  int len = snprintf(body, sizeof(body), "%d %s\n", http_status,
+                     getReasonPhrase(http_status));
+
+  body_buf_.clear();
+  body_buf_.append(body, len);
+  coding_ = CODING_IDENTITY;
+  vary_ = false;
+  setResponse(http_status);
+}
+
+/*
+** function: closeConnection
+**
+** close all fds of session (used when session is closed by server)
+*/
+
+void Session::closeConnection() {
+  finishCgi(true);  // left in the middle of request
+  deflater_.end();
+  closeFile();
+  clearSegments();
+  close(sock_fd_);
+}
+
+/*
+** function: closeFile
+**
+** close file to write (temporary file is removed if upload is not done)
+*/
+
+void Session::closeFile() {
+  if (file_fd_ >= 0) {
+    close(file_fd_);
+  }
+  file_fd_ = -1;
+  if (!upload_path_.empty()) {
+    unlink(upload_path_.c_str());
+  }
+  upload_path_.clear();
+}
+
+/*
+** function: createResponse
+**
+** start processing the first request in queue
+**    - target starting with CGI_PATH_PREFIX is passed to cgi process
+**    - GET reads file under DOCUMENT_ROOT
+**    - PUT and POST write body to file in UPLOAD_DIR (to temporary file
+**      as it is received, which replaces the file when completed), and
+**      are forbidden anywhere else
+*/
+
+SessionStatus Session::createResponse() {
+  const HttpRequest& request = requests_.front();
+  const char* buf = getRequestHead(request);
+  HttpRequest::View method = request.getMethod();
+  std::string target = HttpRequest::toString(buf, request.getTarget());
+
+  // remove query and reject path going out of document root
+  size_t query_pos = target.find('?');
+  std::string query =
+      query_pos == std::string::npos ? "" : target.substr(query_pos + 1);
+  target = target.substr(0, query_pos);
+  if (target.empty() || target[0] != '/' ||
+      target.find("/..") != std::string::npos) {
+    setErrorResponse(HTTP_400);
+    return SESSION_FOR_CLIENT_SEND;
+  } else if (isUploadTemp(target)) {
+    setErrorResponse(HTTP_404);  // upload in progress is not exposed
+    return SESSION_FOR_CLIENT_SEND;
+  }
+
+  // run cgi script or pass request to cgi worker if requested
+  //    - output is compressed if client accepts (not spliced then)
+  if (isCgiTarget(target)) {
+    coding_ = getAcceptedCoding(request);
+    vary_ = true;
+    int http_status =
+        !target.compare(0, strlen(CGI_SCRIPT_PREFIX), CGI_SCRIPT_PREFIX)
+            ? startCgiScript(target, query)
+            : startCgiRequest(target, query);
+    if (http_status != HTTP_200) {
+      setErrorResponse(http_status);
+      return SESSION_FOR_CLIENT_SEND;
+    }
+    return SESSION_FOR_CGI_WRITE;
+  }
+
+  // metrics of all workers
+  if (target == METRICS_PATH) {
+    body_buf_.append(Metrics::format());
+    setResponse(HTTP_200);
+    return SESSION_FOR_CLIENT_SEND;
+  }
+
+  if (target == "/") {
+    target += INDEX_FILE;
+  }
+  filename_ = DOCUMENT_ROOT + target;
+
+  // create response from file
+  //    - file in cache is sent at once, others are opened by FilePool
+  //    - compressed variant of text file is sent if client accepts
+  if (HttpRequest::equals(buf, method, "GET")) {
+    ContentCoding coding = Deflater::isCompressible(filename_)
+                               ? getAcceptedCoding(request)
+                               : CODING_IDENTITY;
+    FileCache::Entry* entry = FileCache::getInstance().acquireVariant(
+        filename_, &coding, last_active_, false);
+    if (entry == NULL && errno == EWOULDBLOCK) {
+      file_job_.path = filename_;
+      file_job_.coding = coding;
+      file_job_.now = last_active_;
+      startFileJob(FILE_JOB_OPEN);
+      return SESSION_FOR_FILE_IO;
+    }
+    return respondFile(entry, coding);
+
+    // write to temporary file (created with body received already by
+    // FilePool, preallocated if its length is known)
+  } else if (HttpRequest::equals(buf, method, "PUT") ||
+             HttpRequest::equals(buf, method, "POST")) {
+    if (!isUploadTarget(target)) {
+      setErrorResponse(HTTP_403);
+      return SESSION_FOR_CLIENT_SEND;
+    }
+    size_t name_pos = filename_.rfind('/') + 1;
+    file_job_.path = filename_.substr(0, name_pos) + "." +
+                     filename_.substr(name_pos) + UPLOAD_TEMP_SUFFIX + "XXXXXX";
+    file_job_.new_path = filename_;
+    file_job_.size = request.getContentLength();
+    setBodyToWrite();
+    startFileJob(FILE_JOB_CREATE);
+    return SESSION_FOR_FILE_IO;
+  }
+
+  setErrorResponse(HTTP_501);
+  return SESSION_FOR_CLIENT_SEND;
+}
+
+/*
+** function: getBodyToWrite
+**
+** returns pointer to request body not written yet and its length
+** (body is not contiguous if chunked or over blocks of buffer,
+**  so returns one contiguous part at a time)
+*/
+
+const char* Session::getBodyToWrite(size_t* len) const {
+  const HttpRequest& request = requests_.front();
+  const std::vector<HttpRequest::View>& body = request.getBody();
+
+  if (body_idx_ >= body.size()) {
+    *len = 0;
+    return NULL;
+  }
+  size_t remain = body[body_idx_].len - body_written_;
+  const char* data = request_buf_.peek(
+      request.getStart() + body[body_idx_].off + body_written_, len);
+  *len = std::min(*len, remain);
+  return data;
+}
+
+/*
+** function: setBodyToWrite
+**
+** set request body not written yet to file_job_ (one contiguous part of it
+** over blocks of buffer), and rename file after it if it is the last part
+*/
+
+void Session::setBodyToWrite() {
+  const HttpRequest& request = requests_.front();
+  const std::vector<HttpRequest::View>& body = request.getBody();
+  size_t remain = 0;
+
+  file_job_.n_iov = 0;
+  file_job_.len = 0;
+  if (body_idx_ < body.size()) {
+    remain = body[body_idx_].len - body_written_;
+    file_job_.n_iov = request_buf_.getIovec(
+        request.getStart() + body[body_idx_].off + body_written_, remain,
+        file_job_.iov, FILE_WRITE_IOV_MAX);
+  }
+  for (int i = 0; i < file_job_.n_iov; ++i) {
+    file_job_.len += file_job_.iov[i].iov_len;
+  }
+  file_job_.commit = !body_streaming_ && file_job_.len == remain &&
+                     body_idx_ + 1 >= body.size();
+}
+
+/*
+** function: consumeBody
+**
+** mark n bytes of request body as written
+*/
+
+void Session::consumeBody(size_t n) {
+  const std::vector<HttpRequest::View>& body = requests_.front().getBody();
+
+  body_written_ += n;
+  if (body_idx_ < body.size() && body_written_ == body[body_idx_].len &&
+      (!body_streaming_ ||
+       body_idx_ + 1 < body.size())) {  // (last view grows while received)
+    ++body_idx_;
+    body_written_ = 0;
+  }
+}
+
+/*
+** function: makeCgiEnv
+**
+** build meta-variables of cgi from the first request in cgi_env_
+**    - headers are passed as HTTP_XXX (except those about body, which is
+**      passed with CONTENT_LENGTH)
+**    - Proxy is not passed, HTTP_PROXY would be taken by script as proxy
+**      to use for its own requests ("httpoxy")
+*/
+
+void Session::makeCgiEnv(const std::string& target, const std::string& query) {
+  const HttpRequest& request = requests_.front();
+  const char* buf = getRequestHead(request);
+  const std::vector<HttpRequest::Header>& headers = request.getHeaders();
+  HttpRequest::View method = request.getMethod();
+  char content_length[24];
+
+  snprintf(content_length, sizeof(content_length), "%lu",
+           static_cast<unsigned long>(body_streaming_
+                                          ? request.getContentLength()
+                                          : request.getBodySize()));
+  cgi_env_.clear();
+  cgi_env_.add("GATEWAY_INTERFACE", "CGI/1.1");
+  cgi_env_.add("SERVER_SOFTWARE", "mini_webserv");
+  cgi_env_.add("SERVER_PROTOCOL",
+               request.getVersionMinor() == 0 ? "HTTP/1.0" : "HTTP/1.1");
+  cgi_env_.add("REQUEST_METHOD", buf + method.off, method.len);
+  cgi_env_.add("SCRIPT_NAME", target);
+  cgi_env_.add("QUERY_STRING", query);
+  cgi_env_.add("CONTENT_LENGTH", content_length, strlen(content_length));
+  for (size_t i = 0; i < headers.size(); ++i) {
+    const HttpRequest::View& name = headers[i].name;
+    const HttpRequest::View& value = headers[i].value;
+    if (HttpRequest::equalsIgnoreCase(buf, name, "Content-Type")) {
+      cgi_env_.add("CONTENT_TYPE", buf + value.off, value.len);
+    } else if (!HttpRequest::equalsIgnoreCase(buf, name, "Content-Length") &&
+               !HttpRequest::equalsIgnoreCase(buf, name,
+                                              "Transfer-Encoding") &&
+               !HttpRequest::equalsIgnoreCase(buf, name, "Proxy")) {
+      cgi_env_.addHeader(buf + name.off, name.len, buf + value.off,
+                         value.len);
+    }
+  }
+}
+
+/*
+** function: startCgiScript
+**
+** start cgi script for the first request with pipes to its stdin/stdout
+**    - script is the file of target under DOCUMENT_ROOT
+**    - body is written to stdin and whole stdout is body of response
+*/
+
+int Session::startCgiScript(const std::string& target,
+                            const std::string& query) {
+  std::string script = DOCUMENT_ROOT + target;
+  int pipe_stdin[2];
+  int pipe_stdout[2];
+
+  if (access(script.c_str(), X_OK) == -1) {
+    return errno == ENOENT ? HTTP_404 : HTTP_403;
+  }
+  makeCgiEnv(target, query);
+  cgi_env_.add("SCRIPT_FILENAME", script);
+
+  // pipes are close-on-exec, ends for script are duplicated to 0 and 1
+  if (pipe2(pipe_stdin, O_CLOEXEC) == -1) {
+    LOG_ERROR("failed to create pipe for cgi script");
+    return HTTP_500;
+  } else if (pipe2(pipe_stdout, O_CLOEXEC) == -1) {
+    LOG_ERROR("failed to create pipe for cgi script");
+    close(pipe_stdin[0]);
+    close(pipe_stdin[1]);
+    return HTTP_500;
+  }
+  int ret = CgiPool::spawnProcess(script.c_str(), pipe_stdin[0],
+                                  pipe_stdout[1], cgi_env_.getEnvp(),
+                                  &cgi_pid_);
+  close(pipe_stdin[0]);
+  close(pipe_stdout[1]);
+  if (ret == -1) {
+    LOG_ERROR("failed to start cgi script " << script);
+    close(pipe_stdin[1]);
+    close(pipe_stdout[0]);
+    cgi_pid_ = -1;
+    return HTTP_502;
+  }
+  cgi_input_fd_ = pipe_stdin[1];
+  cgi_output_fd_ = pipe_stdout[0];
+  fcntl(cgi_input_fd_, F_SETFL, O_NONBLOCK);
+  fcntl(cgi_output_fd_, F_SETFL, O_NONBLOCK);
+  last_active_ = time(NULL);
+  return HTTP_200;
+}
 
 /*
-** default constructor
+** function: startCgiRequest
 **
-** will be used only in list<Session>
+** prepare records of request to cgi worker and get a worker for it
+**    - params are meta-variables of cgi (see makeCgiEnv)
+**    - body is sent as FCGI_STDIN after params (see fillCgiInput)
+**    - session waits in SESSION_FOR_CGI_WRITE without fd if all workers
+**      are busy (see CgiPool)
 */
 
-Session::Session() : status_(SESSION_NOT_INIT), sock_fd_(0), retry_count_(0) {}
-
-/*
-** copy constructor
-**
-** will be used only in list<Session>
-*/
+int Session::startCgiRequest(const std::string& target,
+                             const std::string& query) {
+  std::string params;
 
-Session::Session(const Session& ref) { *this = ref; }
+  makeCgiEnv(target, query);
+  cgi_env_.appendFcgiParams(&params);
 
-/*
-** assignation operator overload
-**
-** will be used only in list<Session>
-*/
+  cgi_out_.clear();
+  cgi_out_sent_ = 0;
+  cgi_stdin_done_ = false;
+  cgi_header_len_ = 0;
+  appendFcgiBeginRequest(&cgi_out_, FCGI_RESPONDER, FCGI_KEEP_CONN);
+  appendFcgiRecord(&cgi_out_, FCGI_PARAMS, params.data(), params.size());
+  appendFcgiRecord(&cgi_out_, FCGI_PARAMS, "", 0);
 
-Session& Session::operator=(const Session& rhs) {
-  if (this == &rhs) {
-    return *this;
+  last_active_ = time(NULL);
+  if (CgiPool::getLocal().acquire(sock_fd_, &cgi_worker_) == -1) {
+    return HTTP_502;
   }
-  sock_fd_ = rhs.sock_fd_;
-  status_ = rhs.status_;
-  request_buf_ = rhs.request_buf_;
-  response_buf_ = rhs.response_buf_;
-  retry_count_ = rhs.retry_count_;
-  return *this;
+  return HTTP_200;
 }
 
 /*
-** destctor
+** function: fillCgiInput
 **
-** do nothing
-** must not close fd in destructor (or fd will be closed when adding to list)
+** replace records written with next FCGI_STDIN records of request body
+** (empty record is appended at the end of body, not while it is received)
 */
 
-Session::~Session() {}
+void Session::fillCgiInput() {
+  size_t len;
+
+  cgi_out_.clear();
+  cgi_out_sent_ = 0;
+  while (cgi_out_.size() < FCGI_CONTENT_MAX) {
+    const char* body = getBodyToWrite(&len);
+    if (len == 0 && body_streaming_) {
+      break;
+    } else if (len == 0) {
+      appendFcgiRecord(&cgi_out_, FCGI_STDIN, "", 0);
+      cgi_stdin_done_ = true;
+      break;
+    }
+    appendFcgiRecord(&cgi_out_, FCGI_STDIN, body, len);
+    consumeBody(len);
+  }
+  releaseBody();
+}
 
 /*
-** getters
+** function: finishCgi
+**
+** return cgi worker to pool or close pipes of cgi script (if any)
+**    - broken: left in the middle of request (script is killed)
 */
 
-SessionStatus Session::getStatus() const { return status_; }
-int Session::getSockFd() const { return sock_fd_; }
-int Session::getFileFd() const { return file_fd_; }
-int Session::getCgiInputFd() const { return cgi_input_fd_; }
-int Session::getCgiOutputFd() const { return cgi_output_fd_; }
+void Session::finishCgi(bool broken) {
+  if (cgi_worker_ != NULL) {
+    CgiPool::getLocal().release(cgi_worker_, broken);
+  }
+  cgi_worker_ = NULL;
+  if (cgi_input_fd_ >= 0) {
+    close(cgi_input_fd_);
+  }
+  if (cgi_output_fd_ >= 0) {
+    close(cgi_output_fd_);
+  }
+  if (broken && cgi_pid_ > 0) {
+    kill(cgi_pid_, SIGKILL);  // reaped by kernel (SIGCHLD is ignored)
+  }
+  cgi_input_fd_ = -1;
+  cgi_output_fd_ = -1;
+  cgi_pid_ = -1;
+}
 
 /*
-** function: recvReq
+** function: writeToCgiProcess
 **
-** receive request from client
+** write records of request to cgi worker (or body to cgi script)
+**    - body being received is also received here and written as it comes
+**      (session waits for both client and cgi, see isBodyReceiving)
+**    - returns -1 if client closed connection in the middle of body
+**      (this session will be closed)
 */
 
-int Session::recvReq() {
-  ssize_t n;
-  char read_buf[BUFFER_SIZE];
+int Session::writeToCgiProcess() {
+  int received = recvBody();
 
-  n = recv(sock_fd_, read_buf, BUFFER_SIZE, 0);
-  if (n == -1) {
-    if (retry_count_ == RETRY_TIME_MAX) {
-      close(sock_fd_);
-      return -1;  // return -1 if error (this session will be closed)
-    }
-    retry_count_++;
-    return 0;
+  if (received == -1) {
+    return -1;
+  } else if (requests_.front().getError() != 0) {
+    return abortCgi(requests_.front().getError());  // broken body
   }
-  request_buf_.append(read_buf, n);
-  /// TODO: add request perser function here
-  if (n == 1 /* this will be resulted from content of request */) {
-    retry_count_ = 0;
-    status_ = createResponse();
-    return 1;
+  io_blocked_ = false;
+  if (cgi_pid_ > 0) {
+    writeToCgiScript();
+  } else {
+    writeToCgiWorker();
+  }
+  if (received == 1) {
+    io_blocked_ = false;  // try again to write body received
   }
-  retry_count_ = 0;
   return 0;
 }
 
 /*
-** function: recvReq
+** function: recvBody
 **
-** send response to client
+** receive request body streamed to cgi or file (see isBodyReceiving)
+** returns 1 if received, 0 if not and -1 if connection is closed
 */
 
-int Session::sendRes() {
-  ssize_t n;
+int Session::recvBody() {
+  size_t len;
 
-  n = send(sock_fd_, response_buf_.c_str(), response_buf_.length(), 0);
-  if (n == -1) {
-    std::cout << "[error] failed to send response" << std::endl;
-    if (retry_count_ == RETRY_TIME_MAX) {
-      std::cout << "[error] close connection" << std::endl;
-      close(sock_fd_);
-      return -1;  // return -1 if error (this session will be closed)
-    }
-    retry_count_++;
+  if (!isBodyReceiving()) {
     return 0;
   }
-  response_buf_.erase(0, n);  // erase data already sent
-  if (response_buf_.empty()) {
-    close(sock_fd_);
-    return 1;  // return 1 if all data sent (this session will be closed)
+  char* buf = request_buf_.prepareWrite(&len);
+  ssize_t n = recv(sock_fd_, buf, len, 0);
+  if (n == -1 && isWouldBlock()) {
+    return 0;
+  } else if (n <= 0) {
+    LOG_INFO("connection closed in the middle of request body");
+    closeConnection();
+    return -1;
   }
-  retry_count_ = 0;  // reset retry_count if success
-  return 0;
+  last_active_ = time(NULL);
+  request_buf_.commitWrite(n);
+  parseRequests();
+  return 1;
 }
 
 /*
-** function: recvReq
+** function: isBodyReceiving
 **
-** send response to client
+** check if session should receive request body while writing it to cgi
+** or file
+**    - not received while CGI_BODY_BUFFER_SIZE (or UPLOAD_BUFFER_SIZE) is
+**      left in buffer (cgi or disk is slower than client, client is blocked
+**      by tcp flow control)
 */
 
-SessionStatus Session::createResponse() {
-  // create cgi process if requested
-  if (!request_buf_.compare(0, 3, "cgi", 0, 3)) {
-    int http_status = createCgiProcess();  //
-    if (http_status != HTTP_200) {
-      std::cout << "[error] failed to create cgi process" << std::endl;
-      response_buf_ = "cannot execute cgi";  // TODO: func create error response
-      return SESSION_FOR_CLIENT_SEND;
-    }
-    return SESSION_FOR_CGI_WRITE;
-
-    // create response from file
-  } else if (!request_buf_.compare(0, 4, "read", 0, 4)) {
-    file_fd_ = open("hello.txt", O_RDONLY);  // toriaezu
-    if (file_fd_ == -1) {
-      response_buf_ = "404 not found";
-      return SESSION_FOR_CLIENT_SEND;
-    }
-    fcntl(file_fd_, F_SETFL, O_NONBLOCK);
-    return SESSION_FOR_FILE_READ;
-
-    // write to file
-  } else if (!request_buf_.compare(0, 4, "write", 0, 4)) {
-    file_fd_ = open("./test_req.txt", O_RDWR | O_CREAT, 0777);  // toriaezu
-    if (file_fd_ == -1) {
-      response_buf_ = "503 forbidden";
-      return SESSION_FOR_CLIENT_SEND;
-    }
-    fcntl(file_fd_, F_SETFL, O_NONBLOCK);
-    return SESSION_FOR_FILE_WRITE;
+bool Session::isBodyReceiving() const {
+  if (!body_streaming_) {
+    return false;
+  } else if (status_ == SESSION_FOR_CGI_WRITE) {
+    return request_buf_.size() < CGI_BODY_BUFFER_SIZE;
   }
-
-  response_buf_ = request_buf_;  // TODO: create function to make response
-  return SESSION_FOR_CLIENT_SEND;
+  return status_ == SESSION_FOR_FILE_WRITE &&
+         request_buf_.size() < UPLOAD_BUFFER_SIZE;
 }
 
 /*
-** function: createCgiProcess
+** function: hasCgiInput
 **
-** create proccess to execute CGI process
-**    - create environment variables and input string for cgi process (TODO!!)
-**    - create piped fds connected to stdin and stdout of CGI process
-**    - create child process for cgi and execute cgi program
+** check if there is data to write to cgi now
+** (nothing while waiting for next part of body from client)
 */
 
-int Session::createCgiProcess() {
-  // create a pipe connect to stdin of cgi process
-  int pipe_stdin[2];
-  if (pipe(pipe_stdin) == -1) {
-    std::cout << "[error] failed to create cgi process" << std::endl;
-    return HTTP_500;
-  }
+bool Session::hasCgiInput() const {
+  size_t len;
 
-  // create a pipe connect to stdout of cgi process
-  int pipe_stdout[2];
-  if (pipe(pipe_stdout) == -1) {
-    std::cout << "[error] failed to create cgi process" << std::endl;
-    close(pipe_stdin[0]);
-    close(pipe_stdin[1]);
-    return HTTP_500;
+  if (!body_streaming_ || cgi_out_sent_ < cgi_out_.size()) {
+    return true;
   }
+  getBodyToWrite(&len);
+  return len > 0;
+}
 
-  // create cgi process
-  cgi_pid_ = fork();
-  if (cgi_pid_ == -1) {  // close pipe if failed
-    close(pipe_stdin[0]);
-    close(pipe_stdin[1]);
-    close(pipe_stdout[0]);
-    close(pipe_stdout[1]);
-    std::cout << "[error] failed to create cgi process" << std::endl;
-    return HTTP_500;
-  } else if (cgi_pid_ == 0) {  // cgi process (child)
-    if (dup2(pipe_stdin[0], 0) == -1 || dup2(pipe_stdout[1], 1) == -1) {
-      std::cerr << "[error] dup2 failed in cgi process" << std::endl;
-      close(0);
-      close(pipe_stdin[0]);
-      close(pipe_stdin[1]);
-      close(pipe_stdout[0]);
-      close(pipe_stdout[1]);
-      exit(1);
-    }
-
-    // close no longer needed pipe fd
-    close(pipe_stdin[0]);
-    close(pipe_stdin[1]);
-    close(pipe_stdout[0]);
-    close(pipe_stdout[1]);
-
-    // excecute cgi process (TODO: implement iroiro)
-    char* argv[] = {(char*)"/bin/cat", (char*)"-e", NULL};
-    execve("/bin/cat", argv, NULL);
-    exit(1);
-  }
+/*
+** function: hasFileInput
+**
+** check if there is request body to write to file now
+** (nothing while waiting for next part of body from client)
+*/
 
-  // save piped fd and set to non blocking
-  cgi_input_fd_ = pipe_stdin[1];
-  cgi_output_fd_ = pipe_stdout[0];
+bool Session::hasFileInput() const {
+  size_t len;
 
-  // set as non blocking fd
-  fcntl(cgi_input_fd_, F_SETFL, O_NONBLOCK);
-  fcntl(cgi_output_fd_, F_SETFL, O_NONBLOCK);
+  if (!body_streaming_) {
+    return true;
+  }
+  getBodyToWrite(&len);
+  return len > 0;
+}
 
-  // close fd not to use in parent process
-  close(pipe_stdin[0]);
-  close(pipe_stdout[1]);
+/*
+** function: releaseBody
+**
+** remove request body already written to cgi or file from buffer while
+** body is received (request line and headers are copied to head_ before that)
+*/
 
-  // change status to cgi write
-  status_ = SESSION_FOR_CGI_WRITE;
+void Session::releaseBody() {
+  const HttpRequest& request = requests_.front();
+  const std::vector<HttpRequest::View>& body = request.getBody();
+  size_t off = request.getEnd();
 
-  // return status 200 on success (but not a final status)
-  return HTTP_200;
+  if (!body_streaming_) {
+    return;
+  } else if (body_idx_ < body.size()) {
+    off = request.getStart() + body[body_idx_].off + body_written_;
+  }
+  if (request.getStart() >= request_buf_.getBegin() &&
+      off > request.getStart()) {
+    head_.assign(getRequestHead(request), request.getHeaderSize());
+  }
+  request_buf_.consumeTo(off);
 }
 
 /*
-** function: writeToCgiProcess
+** function: writeToCgiWorker
+**
+** write records of request to cgi worker
+**    - session woken up from waiting gets a worker first
+**    - worker closed connection means it crashed (502 is returned)
 */
 
-int Session::writeToCgiProcess() {
-  ssize_t n;
-
-  // write to cgi process
-  n = write(cgi_input_fd_, request_buf_.c_str(), request_buf_.length());
+void Session::writeToCgiWorker() {
+  if (cgi_worker_ == NULL) {
+    int ret = CgiPool::getLocal().acquire(sock_fd_, &cgi_worker_);
+    if (ret == -1) {
+      failRequest(HTTP_502);
+      return;
+    } else if (ret == 1) {
+      io_blocked_ = true;  // wait for a worker again
+      return;
+    }
+  }
+  if (cgi_out_sent_ == cgi_out_.size()) {
+    fillCgiInput();
+  }
+  if (cgi_out_.empty()) {
+    io_blocked_ = true;  // wait for body from client
+    return;
+  }
 
-  // retry several times even if write failed
+  ssize_t n = write(cgi_worker_->fd, cgi_out_.data() + cgi_out_sent_,
+                    cgi_out_.size() - cgi_out_sent_);
   if (n == -1) {
-    std::cout << "[error] failed to write to CGI process" << std::endl;
-
-    // give up if reached retry count to maximum
-    if (retry_count_ == RETRY_TIME_MAX) {
-      retry_count_ = 0;
-
-      // close connection
-      std::cout << "[error] close connection from CGI process" << std::endl;
-      close(cgi_input_fd_);
-
-      // expect response from cgi process
-      status_ = SESSION_FOR_CGI_READ;  // to read from cgi process
-      return 0;
+    if (isWouldBlock()) {
+      io_blocked_ = true;
+      return;
     }
-
-    retry_count_++;
-    return 0;
+    LOG_ERROR("failed to write to cgi worker");
+    finishCgi(true);
+    failRequest(HTTP_502);
+    return;
   }
+  last_active_ = time(NULL);
+  cgi_out_sent_ += n;
+
+  // all records of request written
+  if (cgi_out_sent_ == cgi_out_.size() && cgi_stdin_done_) {
+    cgi_out_.clear();
+    cgi_out_sent_ = 0;
+    setStatus(SESSION_FOR_CGI_READ);
+  }
+}
 
-  // reset retry conunt on success
-  retry_count_ = 0;
+/*
+** function: readFromCgiProcess
+**
+** read records of response from cgi worker (or output of cgi script)
+**    - content of FCGI_STDOUT is read directly in body_buf_ (it is body
+**      of response), FCGI_STDERR is logged and others are discarded
+**    - body_buf_ is streamed to client when it reaches
+**      CGI_STREAM_BUFFER_SIZE or worker has no more output for now
+**      (small records are coalesced in a chunk, worker is not read while
+**      it is sent, see sendRes)
+**    - response is completed by FCGI_END_REQUEST and worker is released
+**      (with Content-Length if nothing is streamed yet)
+*/
 
-  // erase written data
-  request_buf_.erase(0, n);
+int Session::readFromCgiProcess() {
+  char discard[1024];
+  char* buf;
+  size_t len;
+
+  if (cgi_pid_ > 0) {
+    return readFromCgiScript();
+  } else if (cgi_header_len_ < FCGI_HEADER_LEN) {
+    buf = cgi_header_ + cgi_header_len_;
+    len = FCGI_HEADER_LEN - cgi_header_len_;
+  } else if (cgi_record_.content_length > 0 &&
+             cgi_record_.type == FCGI_STDOUT) {
+    buf = body_buf_.prepareWrite(&len);  // read directly in buffer
+    len = std::min(len, cgi_record_.content_length);
+  } else {
+    buf = discard;
+    len = std::min(sizeof(discard), cgi_record_.content_length > 0
+                                        ? cgi_record_.content_length
+                                        : cgi_record_.padding_length);
+  }
 
-  // written all data
-  if (request_buf_.empty()) {
-    close(cgi_input_fd_);
-    status_ = SESSION_FOR_CGI_READ;  // to read from cgi process
+  io_blocked_ = false;
+  ssize_t n = read(cgi_worker_->fd, buf, len);
+  if (n == -1 && isWouldBlock()) {
+    io_blocked_ = true;
+    if (!body_buf_.empty()) {
+      return flushCgiOutput();  // send what is produced so far
+    }
     return 0;
+  } else if (n <= 0) {
+    LOG_ERROR("cgi worker closed connection in the middle of response");
+    return abortCgi(HTTP_502);
+  }
+  last_active_ = time(NULL);
+
+  if (cgi_header_len_ < FCGI_HEADER_LEN) {
+    cgi_header_len_ += n;
+    if (cgi_header_len_ == FCGI_HEADER_LEN &&
+        parseFcgiHeader(cgi_header_, &cgi_record_) == -1) {
+      LOG_ERROR("broken record from cgi worker");
+      return abortCgi(HTTP_502);
+    }
+  } else if (cgi_record_.content_length > 0) {
+    if (cgi_record_.type == FCGI_STDOUT) {
+      body_buf_.commitWrite(n);
+    } else if (cgi_record_.type == FCGI_STDERR) {
+      LOG_WARN("cgi: " << std::string(buf, n));
+    }
+    cgi_record_.content_length -= n;
+  } else {
+    cgi_record_.padding_length -= n;
   }
 
-  // to next read
+  // end of a record
+  if (cgi_header_len_ == FCGI_HEADER_LEN && cgi_record_.content_length == 0 &&
+      cgi_record_.padding_length == 0) {
+    cgi_header_len_ = 0;
+    if (cgi_record_.type == FCGI_END_REQUEST) {
+      if (cgi_streaming_) {
+        return endCgiStream();
+      }
+      finishCgi(false);
+      completeRequest(HTTP_200);  // output of cgi is body
+      return 0;
+    }
+  }
+  if (!body_buf_.empty() && (body_buf_.size() >= CGI_STREAM_BUFFER_SIZE ||
+                             getReadableSize(cgi_worker_->fd) == 0)) {
+    return flushCgiOutput();
+  }
   return 0;
 }
 
 /*
-** function: readFromCgiProcess
+** function: writeToCgiScript
+**
+** write request body to stdin of cgi script and close it at the end
+** (script may exit without reading all of it, then its output is read)
 */
 
-int Session::readFromCgiProcess() {
-  ssize_t n;
-  char read_buf[BUFFER_SIZE];
+void Session::writeToCgiScript() {
+  size_t len;
+  const char* body = getBodyToWrite(&len);
+
+  if (len == 0 && body_streaming_) {
+    io_blocked_ = true;  // wait for body from client
+    return;
+  } else if (len > 0) {
+    ssize_t n = write(cgi_input_fd_, body, len);
+    if (n == -1 && isWouldBlock()) {
+      io_blocked_ = true;
+      return;
+    } else if (n > 0) {
+      last_active_ = time(NULL);
+      consumeBody(n);
+      releaseBody();
+      return;
+    }
+    LOG_ERROR("failed to write to cgi script");
+  }
+  close(cgi_input_fd_);
+  cgi_input_fd_ = -1;
+  setStatus(SESSION_FOR_CGI_READ);
+}
 
-  // read from cgi process
-  n = read(cgi_output_fd_, read_buf, BUFFER_SIZE);
+/*
+** function: readFromCgiScript
+**
+** stream output of cgi script to client until it is closed
+**    - output of CGI_SPLICE_MIN or more in pipe is sent by splice (not read
+**      to memory), pipe is not read while it is sent (script blocks when
+**      pipe is full), unless it is compressed
+**    - less output is read and coalesced in body_buf_ until script pauses
+**      (or CGI_STREAM_BUFFER_SIZE is read) not to send tiny chunks
+*/
 
-  // retry seveal times even if read failed
-  if (n == -1) {
-    std::cout << "[error] failed to read from cgi process" << std::endl;
-    if (retry_count_ == RETRY_TIME_MAX) {
-      retry_count_ = 0;
+int Session::readFromCgiScript() {
+  size_t len;
 
-      // close connection and make error responce
-      std::cout << "[error] close connection to CGI process" << std::endl;
-      close(cgi_output_fd_);
-      response_buf_ = "500 internal server error";  // TODO: make response func
+  if (body_buf_.empty() && coding_ == CODING_IDENTITY &&
+      (len = getReadableSize(cgi_output_fd_)) >= CGI_SPLICE_MIN) {
+    last_active_ = time(NULL);
+    if (!cgi_streaming_) {
+      startCgiStream();
+    }
+    appendPipeChunk(cgi_output_fd_, len);
+    setStatus(SESSION_FOR_CLIENT_SEND);
+    return 0;
+  }
 
-      // kill the process on error (if failed kill, we can do nothing...)
-      if (kill(cgi_pid_, SIGKILL) == -1) {
-        std::cout << "[error] failed kill cgi process" << std::endl;
+  char* buf = body_buf_.prepareWrite(&len);
+  ssize_t n = read(cgi_output_fd_, buf, len);
+  if (n == -1) {
+    if (isWouldBlock()) {
+      io_blocked_ = true;
+      if (!body_buf_.empty()) {
+        return flushCgiOutput();
       }
-
-      // to send error response to client
-      status_ = SESSION_FOR_CLIENT_SEND;
       return 0;
     }
-    retry_count_++;
-    return 0;
+    LOG_ERROR("failed to read from cgi script");
+    return abortCgi(HTTP_502);
   }
-
-  // reset retry conunt on success
-  retry_count_ = 0;
-
-  // check if pipe closed
-  if (n == 0) {
-    close(cgi_output_fd_);              // close pipefd
-    status_ = SESSION_FOR_CLIENT_SEND;  // set for send response
+  last_active_ = time(NULL);
+  if (n == 0 && cgi_streaming_) {
+    return endCgiStream();
+  } else if (n == 0) {
+    finishCgi(false);
+    completeRequest(HTTP_200);  // output of cgi is body
     return 0;
   }
-
-  // append data to response
-  response_buf_.append(read_buf, n);
-
+  body_buf_.commitWrite(n);
+  if (body_buf_.size() >= CGI_STREAM_BUFFER_SIZE ||
+      getReadableSize(cgi_output_fd_) == 0) {
+    return flushCgiOutput();
+  }
   return 0;
 }
 
 /*
-** function: readFromFile
+** function: startCgiStream
 **
-** read from file refered by file_fd_ and store to response
+** start response streamed with output of cgi as body
+** (session goes back to read cgi each time output is sent, see sendRes)
 */
 
-int Session::readFromFile() {
-  ssize_t n;
-  char read_buf[BUFFER_SIZE];
-
-  // read from file
-  n = read(file_fd_, read_buf, BUFFER_SIZE);
-
-  // retry seveal times even if read failed
-  if (n == -1) {
-    std::cout << "[error] failed to read from file" << std::endl;
-    if (retry_count_ == RETRY_TIME_MAX) {
-      retry_count_ = 0;
+void Session::startCgiStream() {
+  if (coding_ != CODING_IDENTITY &&
+      deflater_.start(coding_, COMPRESS_STREAM_LEVEL) == -1) {
+    coding_ = CODING_IDENTITY;
+  }
+  startStreamResponse(HTTP_200);
+  cgi_streaming_ = true;
+}
 
-      // close file and make error responce
-      std::cout << "[error] close file" << std::endl;
-      close(cgi_output_fd_);
-      response_buf_ = "500 internal server error";  // TODO: make response func
+/*
+** function: flushCgiOutput
+**
+** start streaming (if not yet) and send output of cgi in body_buf_
+**    - returns -1 if output cannot be compressed (connection is closed as
+**      response cannot be completed, this session will be closed)
+*/
 
-      // to send error response to client
-      status_ = SESSION_FOR_CLIENT_SEND;
-      return 0;
-    }
-    retry_count_++;
-    return 0;
+int Session::flushCgiOutput() {
+  if (!cgi_streaming_) {
+    startCgiStream();
+  }
+  if (appendChunk(body_buf_) == -1) {
+    return abortCgi(HTTP_500);
   }
+  setStatus(SESSION_FOR_CLIENT_SEND);
+  return 0;
+}
 
-  // reset retry conunt on success
-  retry_count_ = 0;
+/*
+** function: endCgiStream
+**
+** finish response streamed when cgi finished output and go to next request
+**    - returns -1 if connection is closed to tell end of body which is sent
+**      already (this session will be closed)
+*/
 
-  // check if reached eof
-  if (n == 0) {
-    close(cgi_output_fd_);              // close pipefd
-    status_ = SESSION_FOR_CLIENT_SEND;  // set for send response
-    return 0;
+int Session::endCgiStream() {
+  finishCgi(false);
+  if (appendChunk(body_buf_) == -1 || appendLastChunk() == -1) {
+    closeConnection();  // body cannot be completed
+    return -1;
   }
+  cgi_streaming_ = false;
+  finishRequest();
+  if (segments_.empty()) {
+    closeConnection();
+    return -1;
+  }
+  setStatus(processRequests());
+  return 0;
+}
 
-  // append data to response
-  response_buf_.append(read_buf, n);
+/*
+** function: abortCgi
+**
+** handle failure of cgi (or of request body streamed to it) with error
+** response of http_status
+**    - returns -1 if a part of response is sent already (connection is
+**      closed as response cannot be completed, this session will be closed)
+*/
 
+int Session::abortCgi(int http_status) {
+  finishCgi(true);
+  if (cgi_streaming_) {
+    closeConnection();
+    return -1;
+  }
+  failRequest(http_status);
   return 0;
 }
 
 /*
 ** function: writeToFile
 **
-** read from file refered by file_fd_ and store to response
+** write request body to file refered by file_fd_ by FilePool
+**    - body being received is also received here (up to UPLOAD_BUFFER_SIZE)
+**      and written as it comes (see isBodyReceiving)
+**    - file is renamed to filename_ after all body is written
+**    - returns -1 if client closed connection in the middle of body
+**      (this session will be closed)
 */
 
 int Session::writeToFile() {
-  ssize_t n;
+  int received;
+
+  io_blocked_ = false;
+  while ((received = recvBody()) == 1) {
+  }
+  if (received == -1) {
+    return -1;
+  } else if (requests_.front().getError() != 0) {
+    closeFile();
+    failRequest(requests_.front().getError());  // broken body
+    return 0;
+  }
+  setBodyToWrite();
+  if (file_job_.len == 0 && !file_job_.commit) {
+    io_blocked_ = true;  // wait for body from client
+    return 0;
+  }
+  file_job_.fd = file_fd_;
+  startFileJob(FILE_JOB_WRITE);
+  setStatus(SESSION_FOR_FILE_IO);
+  return 0;
+}
 
-  // write to file
-  n = write(file_fd_, request_buf_.c_str(), request_buf_.length());
+/*
+** function: finishWrite
+**
+** update request body after n bytes of it are written to file
+** (n is -1 and errno is set if failed)
+*/
 
+void Session::finishWrite(ssize_t n) {
   // retry several times even if write failed
   if (n == -1) {
-    std::cout << "[error] failed to write to file" << std::endl;
+    LOG_ERROR("failed to write to file");
 
     // give up if reached retry count to maximum
     if (retry_count_ == RETRY_TIME_MAX) {
       retry_count_ = 0;
 
       // close connection
-      std::cout << "[error] close file" << std::endl;
-      close(file_fd_);
+      LOG_ERROR("close file");
+      closeFile();
 
       // send response to notify request failed
-      response_buf_ = "500 server error";
-      status_ = SESSION_FOR_CLIENT_SEND;  // to send response to client
-      return 0;
+      failRequest(HTTP_500);
+      return;
     }
 
     retry_count_++;
-    return 0;
+    return;
   }
 
   // reset retry conunt on success
   retry_count_ = 0;
 
-  // erase written data
-  request_buf_.erase(0, n);
+  // skip written data (and remove it from buffer while body is received)
+  consumeBody(n);
+  releaseBody();
+}
 
-  // written all data
-  if (request_buf_.empty()) {
-    close(file_fd_);
+/*
+** function: finishUpload
+**
+** respond to request after its body is written to temporary file and it
+** is renamed to filename_ (file is closed by FilePool)
+*/
 
-    // create response to notify the client
-    response_buf_ = "201 created";
-    status_ = SESSION_FOR_CLIENT_SEND;  // to send response to client
-    return 0;
+void Session::finishUpload(int result) {
+  file_fd_ = -1;
+  if (result == -1) {
+    LOG_ERROR("failed to rename file");
+    closeFile();
+    failRequest(HTTP_403);
+    return;
   }
+  upload_path_.clear();
+  FileCache::getInstance().invalidate(filename_);
+
+  // create response to notify the client
+  body_buf_.clear();
+  body_buf_.append("201 created\n");
+  completeRequest(HTTP_201);
+}
+
+/*
+** function: startFileJob
+**
+** submit file_job_ (with its arguments set) to FilePool
+** (completion is told to worker of this thread with key of session)
+*/
+
+void Session::startFileJob(FileJobType type) {
+  file_job_.type = type;
+  file_job_.key = sock_fd_;
+  file_job_.completions = &FileCompletions::getLocal();
+  file_job_.finished = false;
+  file_job_start_ = time(NULL);
+  FilePool::getInstance().submit(&file_job_);
+}
+
+/*
+** function: abandon
+**
+** give up session timed out while FilePool or io_uring does its job
+**    - connection is shut down now, but fds and buffers are kept until the
+**      job is done (and fd number of socket is not reused before that)
+**    - recv or send submitted to io_uring ends by the shutdown
+*/
+
+void Session::abandon() {
+  abandoned_ = true;
+  shutdown(sock_fd_, SHUT_RDWR);
+}
 
-  // to next read
+/*
+** function: finishFileJob
+**
+** continue with result of file_job_ after FilePool completed it
+**    - returns -1 if session should be closed (as sendRes)
+**    - does nothing if the job is not finished yet
+**    - session abandoned is closed with what the job acquired
+*/
+
+int Session::finishFileJob() {
+  if (!file_job_.finished) {
+    return 0;
+  }
+  if ((file_job_.type == FILE_JOB_CREATE ||
+       file_job_.type == FILE_JOB_RENAME) && file_job_.fd >= 0) {
+    upload_path_ = file_job_.path;  // temporary file (named when created)
+  }
+  if (abandoned_) {
+    if (file_job_.type == FILE_JOB_OPEN && file_job_.entry != NULL) {
+      FileCache::getInstance().release(file_job_.entry);
+    } else if (file_job_.type == FILE_JOB_CREATE) {
+      file_fd_ = file_job_.fd;
+    } else if (file_job_.type == FILE_JOB_RENAME) {
+      file_fd_ = -1;  // closed by FilePool
+      if (file_job_.result == 0) {
+        upload_path_.clear();
+      }
+    }
+    closeConnection();
+    return -1;
+  }
+  errno = file_job_.error;
+  switch (file_job_.type) {
+    case FILE_JOB_OPEN:
+      respondFile(file_job_.entry, file_job_.coding);
+      finishRequest();
+      setStatus(processRequests());
+      return 0;
+    case FILE_JOB_CREATE:
+      file_fd_ = file_job_.fd;
+      if (file_fd_ == -1) {
+        closeFile();
+        failRequest(HTTP_403);
+        return 0;
+      }
+      // fall through - data is written with open
+    case FILE_JOB_WRITE:
+      setStatus(SESSION_FOR_FILE_WRITE);
+      finishWrite(file_job_.result);
+      if (status_ == SESSION_FOR_FILE_WRITE && retry_count_ == 0) {
+        return writeToFile();  // continue without waiting (not failed)
+      }
+      return 0;
+    case FILE_JOB_RENAME:
+      finishUpload(file_job_.result);
+      return 0;
+    case FILE_JOB_SENDFILE:
+      setStatus(SESSION_FOR_CLIENT_SEND);
+      return finishSend(file_job_.result);
+  }
   return 0;
 }
@@ -6,7 +6,7 @@
 /*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
 /*                                                +#+#+#+#+#+   +#+           */
 /*   Created: 2021/02/24 16:26:56 by dnakano           #+#    #+#             */
-/*   Updated: 2021/02/27 14:12:03 by dnakano          ###   ########.fr       */
+/*   Updated: 2021/03/28 19:05:00 by dnakano          ###   ########.fr       */
 /*                                                                            */
 /* ************************************************************************** */
 
@@ -14,10 +14,23 @@
 #define SESSION_HPP
 
 #include <sys/types.h>
+#include <time.h>
 
+#include <deque>
 #include <string>
 
+#include "CgiEnv.hpp"
+#include "CgiPool.hpp"
+#include "Deflater.hpp"
+#include "Epoll.hpp"
+#include "FastCgi.hpp"
+#include "FileCache.hpp"
+#include "FilePool.hpp"
+#include "HttpRequest.hpp"
+#include "IoBuffer.hpp"
+#include "TimerWheel.hpp"
 #include "config.hpp"
+#include "http.hpp"
 
 // #define SESSION_NOT_INIT 0x0000
 // #define SESSION_FOR_CLIENT_RECV 0x0001
@@ -26,14 +39,7 @@
 // #define SESSION_FOR_CGI_READ 0x0012
 // #define SESSION_FOR_FILE_READ 0x0021
 // #define SESSION_FOR_FILE_WRITE 0x0022
-
-#define HTTP_200 200  // 200 OK
-#define HTTP_403 403  // 403 Forbidden
-#define HTTP_404 404  // 404 Not Found
-#define HTTP_418 418  // 418 I'm a teapot
-#define HTTP_500 500  // 500 Internal Server Error
-#define HTTP_501 501  // 501 Not Implemented
-#define HTTP_502 502  // 502 Bad Gateway
+// #define SESSION_FOR_FILE_IO 0x0023
 
 // sessionStatus
 enum SessionStatus {
@@ -42,45 +48,178 @@ enum SessionStatus {
   SESSION_FOR_CLIENT_SEND,
   SESSION_FOR_CGI_WRITE,
   SESSION_FOR_CGI_READ,
-  SESSION_FOR_FILE_READ,
-  SESSION_FOR_FILE_WRITE
+  SESSION_FOR_FILE_WRITE,
+  SESSION_FOR_FILE_IO,  // waiting for FilePool (no fd to wait for)
+  SESSION_STATUS_NUM  // number of status (not a status)
+};
+
+// part of response to send
+//    - data in memory (static data or content of cached file) if data is set
+//    - next len bytes of response_buf_ if data is NULL and fd is -1
+//    - region of file sent by sendfile if fd is set
+//    - data in pipe sent by splice if fd is set and offset is -1
+struct ResponseSegment {
+  const char* data;          // data in memory (or NULL)
+  int fd;                    // file or pipe to send (or -1)
+  off_t offset;              // offset of file to send next (-1 if pipe)
+  size_t len;                // bytes not sent yet
+  FileCache::Entry* entry;   // cache entry kept until sent (or NULL)
+  bool cached;               // file is found in page cache (see sendRes)
+};
+
+// end of response made and not sent yet (to observe duration of request)
+struct ResponseEnd {
+  size_t end;                   // sent_bytes_ when response is sent
+  unsigned long request_start;  // time request started (usec)
 };
 
 class Session {
  private:
   SessionStatus status_;      // status of session (defined by SESSION_XXX)
   int sock_fd_;               // fd of socket to client
-  int cgi_input_fd_;          // cgi_fd_[0] will connected to STDIN of cgi
-  int cgi_output_fd_;         // cgi_fd_[1] will connected to STDOUT of cgi
-  int file_fd_;               // fd of file to read/write
-  pid_t cgi_pid_;             // pid of cgi process
-  std::string request_buf_;   // to store request
-  std::string response_buf_;  // to store response
-  std::string filename;       // to store filename to read/write
+  int file_fd_;               // fd of file to write
+  int cgi_input_fd_;          // pipe to stdin of cgi script
+  int cgi_output_fd_;         // pipe from stdout of cgi script
+  pid_t cgi_pid_;             // pid of cgi script (-1 if none)
+  CgiEnv cgi_env_;            // meta-variables of cgi request
+  CgiWorker* cgi_worker_;     // cgi worker processing request (or NULL)
+  std::string cgi_out_;       // records to write to cgi worker
+  size_t cgi_out_sent_;       // bytes of cgi_out_ written
+  bool cgi_stdin_done_;       // end of FCGI_STDIN is in cgi_out_
+  char cgi_header_[FCGI_HEADER_LEN];  // header of record reading
+  size_t cgi_header_len_;     // bytes of cgi_header_ read
+  FcgiHeader cgi_record_;     // record reading (lengths are bytes left)
+  bool cgi_streaming_;        // header of cgi response is sent, body follows
+  bool chunked_;              // body of response streamed is chunked
+  ContentCoding coding_;      // content coding of response body
+  bool vary_;                 // response depends on Accept-Encoding
+  Deflater deflater_;         // compressor of body streamed
+  std::string headers_;       // more header fields of response (or empty)
+  IoBuffer request_buf_;      // to store request
+  HttpRequest parser_;        // parser of request_buf_ (request receiving)
+  std::deque<HttpRequest> requests_;  // requests received (first is active)
+  bool body_streaming_;       // body of first request is still received
+  std::string head_;          // head of first request released from buffer
+  size_t body_idx_;           // index of request body view to write next
+  size_t body_written_;       // bytes written of the view at body_idx_
+  IoBuffer response_buf_;     // to store responses ready to send
+  std::deque<ResponseSegment> segments_;  // responses ready to send in order
+  size_t response_size_;      // bytes of segments_ not sent yet
+  size_t sent_bytes_;         // bytes of responses sent on connection
+  std::deque<ResponseEnd> response_ends_;  // responses in segments_
+  IoBuffer body_buf_;         // to store body of response now creating
+  std::string filename_;      // to store filename to read/write
+  std::string upload_path_;   // temporary file written (renamed to filename_)
+  FileJob file_job_;          // file I/O done by FilePool (see startFileJob)
+  time_t file_job_start_;     // time file_job_ is submitted
+  bool abandoned_;            // timed out while file_job_ or uring_op_ done
+  int n_requests_;            // number of requests on this connection
+  bool keep_alive_;           // keep connection after sending response
+  time_t last_active_;        // time of last progress of I/O
+  time_t header_start_;       // time of first byte of request receiving
   int retry_count_;           // use to count failure
+  bool io_blocked_;           // last I/O returned EAGAIN (for edge trigger)
+  UringOp uring_op_;          // recv or send submitted to io_uring (or none)
+  IoBuffer file_buf_;         // file read by io_uring to send (see sendRes)
+  TimerNode timer_;           // timer to close session (see getDeadline)
+  unsigned long status_since_;   // time status_ was set (usec, for metrics)
+  unsigned long request_start_;  // time request started (usec, for metrics)
+
+  void setStatus(SessionStatus status);
+
+  void parseRequests();
+  bool isBodyStreamable(const HttpRequest& request) const;
+  int recvBody();
+  void releaseBody();
+  const char* getRequestHead(const HttpRequest& request) const;
+  bool isKeepAlive(const HttpRequest& request) const;
+  ContentCoding getAcceptedCoding(const HttpRequest& request) const;
+  SessionStatus processRequests();
+  SessionStatus startRequest();
+  void finishRequest();
+  void completeRequest(int http_status);
+  void failRequest(int http_status);
+  void setResponse(int http_status);
+  SessionStatus respondFile(FileCache::Entry* entry, ContentCoding coding);
+  void setFileResponse(FileCache::Entry* entry);
+  bool isRangeFresh(const FileCache::Entry* entry) const;
+  void appendFileBody(FileCache::Entry* entry, off_t offset, size_t len);
+  void compressBody();
+  void appendResponseHeader(int http_status, size_t content_length);
+  void logAccess(int http_status, size_t content_length) const;
+  void appendSegment(const char* data, size_t len, FileCache::Entry* entry);
+  void appendFileSegment(FileCache::Entry* entry, off_t offset, size_t len);
+  void appendBufferSegment(IoBuffer& buf);
+  void appendCopySegment(const char* str);
+  void appendCopySegment(const char* data, size_t len);
+  void appendPipeSegment(int fd, size_t len);
+  void startStreamResponse(int http_status);
+  int appendChunk(IoBuffer& data);
+  void appendPipeChunk(int fd, size_t len);
+  void appendChunkSize(size_t len);
+  int appendLastChunk();
+  void advanceSegments(size_t n);
+  void observeSent();
+  void clearSegments();
+  void closeFile();
+  void startFileJob(FileJobType type);
+  ssize_t takeIoResult();
+  int finishSendOp();
+  int finishSend(ssize_t n);
+  void finishWrite(ssize_t n);
+  void finishUpload(int result);
+  void setErrorResponse(int http_status);
+  void makeCgiEnv(const std::string& target, const std::string& query);
+  int startCgiScript(const std::string& target, const std::string& query);
+  int startCgiRequest(const std::string& target, const std::string& query);
+  void fillCgiInput();
+  void writeToCgiWorker();
+  void writeToCgiScript();
+  int readFromCgiScript();
+  void startCgiStream();
+  int flushCgiOutput();
+  int endCgiStream();
+  int abortCgi(int http_status);
+  void finishCgi(bool broken);
+  const char* getBodyToWrite(size_t* len) const;
+  void setBodyToWrite();
+  void consumeBody(size_t n);
+
+  // do not allow copy and assignation
+  Session(const Session& ref);
+  Session& operator=(const Session& ref);
 
  public:
   Session();
-  Session(int sock_fd);
-  Session& operator=(const Session& ref);
-  Session(const Session& ref);
   ~Session();
 
+  // start and end of use (see SessionTable)
+  void init(int sock_fd);
+  void clear();
+
   // getters
+  static const char* getStatusName(SessionStatus status);
   SessionStatus getStatus() const;
   int getSockFd() const;
   int getFileFd() const;
-  int getCgiInputFd() const;
-  int getCgiOutputFd() const;
+  int getCgiFd() const;
+  bool isIoBlocked() const;
+  bool isIoSubmitted() const;
+  bool isBodyReceiving() const;
+  bool hasCgiInput() const;
+  bool hasFileInput() const;
+  TimerNode* getTimer();
+  time_t getDeadline() const;
 
   int recvReq();
   int sendRes();
   SessionStatus createResponse();
-  int createCgiProcess();
   int writeToCgiProcess();
   int readFromCgiProcess();
-  int readFromFile();
   int writeToFile();
+  int finishFileJob();
+  void abandon();
+  void closeConnection();
 };
 
 #endif /* SESSION_HPP */
@@ -0,0 +1,97 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   SessionTable.cpp                                   :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/14 15:12:33 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/14 15:12:33 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "SessionTable.hpp"
+
+/*
+** constructor
+**
+** no session is allocated until first create()
+*/
+
+SessionTable::SessionTable() : n_sessions_(0) {}
+
+/*
+** destructor
+**
+** free all sessions allocated
+*/
+
+SessionTable::~SessionTable() {
+  for (size_t i = 0; i < slabs_.size(); ++i) {
+    delete[] slabs_[i];
+  }
+}
+
+/*
+** getters
+*/
+
+size_t SessionTable::size() const { return n_sessions_; }
+int SessionTable::getFdMax() const { return slots_.size(); }
+
+/*
+** function: get
+**
+** returns session of fd (or NULL if fd has no session)
+*/
+
+Session* SessionTable::get(int fd) const {
+  if (fd < 0 || static_cast<size_t>(fd) >= slots_.size()) {
+    return NULL;
+  }
+  return slots_[fd];
+}
+
+/*
+** function: create
+**
+** take session from free list and initialize it for socket fd
+**    - new slab is allocated only when free list is empty
+*/
+
+Session* SessionTable::create(int fd) {
+  if (free_.empty()) {
+    Session* slab = new Session[SESSION_SLAB_SIZE];
+    slabs_.push_back(slab);
+    for (int i = SESSION_SLAB_SIZE - 1; i >= 0; --i) {
+      free_.push_back(slab + i);
+    }
+  }
+  if (static_cast<size_t>(fd) >= slots_.size()) {
+    slots_.resize(fd + 1, NULL);
+  }
+  Session* session = free_.back();
+  free_.pop_back();
+  session->init(fd);
+  slots_[fd] = session;
+  ++n_sessions_;
+  return session;
+}
+
+/*
+** function: destroy
+**
+** clear session of fd and return it to free list
+*/
+
+void SessionTable::destroy(int fd) {
+  Session* session = get(fd);
+
+  if (session == NULL) {
+    return;
+  }
+  session->clear();
+  slots_[fd] = NULL;
+  free_.push_back(session);
+  --n_sessions_;
+}
@@ -0,0 +1,59 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   SessionTable.hpp                                   :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/14 15:12:33 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/14 15:12:33 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef SESSIONTABLE_HPP
+#define SESSIONTABLE_HPP
+
+#include <vector>
+
+#include "Session.hpp"
+#include "config.hpp"
+
+/*
+** sessions of one worker indexed by fd of socket
+**
+** sessions are allocated SESSION_SLAB_SIZE at a time and reused through
+** free list, so creating and destroying a session does not allocate
+** memory (memory of buffers in session is also kept for next use).
+** lookup from fd (epoll event) is just an index of vector.
+*/
+
+class SessionTable {
+ private:
+  std::vector<Session*> slots_;  // session in use indexed by fd (or NULL)
+  std::vector<Session*> free_;   // sessions not in use
+  std::vector<Session*> slabs_;  // arrays of sessions allocated
+  size_t n_sessions_;            // number of sessions in use
+
+  // do not allow copy and assignation
+  SessionTable(const SessionTable& ref);
+  SessionTable& operator=(const SessionTable& ref);
+
+ public:
+  SessionTable();
+  ~SessionTable();
+
+  // getters
+  size_t size() const;
+  int getFdMax() const;  // upper bound of fd of sessions (to iterate)
+
+  // returns session of fd (or NULL)
+  Session* get(int fd) const;
+
+  // take session from free list for socket fd
+  Session* create(int fd);
+
+  // return session of fd to free list (fds must be closed by caller)
+  void destroy(int fd);
+};
+
+#endif /* SESSIONTABLE_HPP */
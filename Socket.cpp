@@ -6,17 +6,17 @@
 /*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
 /*                                                +#+#+#+#+#+   +#+           */
 /*   Created: 2021/02/24 18:42:30 by dnakano           #+#    #+#             */
-/*   Updated: 2021/02/25 13:09:08 by dnakano          ###   ########.fr       */
+/*   Updated: 2021/03/19 17:44:09 by dnakano          ###   ########.fr       */
 /*                                                                            */
 /* ************************************************************************** */
 
 #include "Socket.hpp"
 
+#include <errno.h>
 #include <fcntl.h>       // fcntl
 #include <sys/socket.h>  // socket
 #include <unistd.h>      // close
 
-#include <iostream>
 #include <stdexcept>
 
 /*
@@ -26,7 +26,7 @@
 ** will check value in each member functions
 */
 
-Socket::Socket() : fd_(0), port_(0) {}
+Socket::Socket() : fd_(0), port_(0), reserve_fd_(-1) {}
 
 /*
 ** destructor
@@ -38,6 +38,9 @@ Socket::~Socket() {
   if (fd_ > 0) {
     close(fd_);
   }
+  if (reserve_fd_ >= 0) {
+    close(reserve_fd_);
+  }
 }
 
 /*
@@ -51,6 +54,7 @@ int Socket::getFd() const { return fd_; }
 **
 ** initialize socket
 **  - create end point of the socket
+**  - allow other workers to bind the same port (SO_REUSEPORT)
 **  - create addressing info
 **  - bind the address to the socket
 **  - make the socket ready to listen
@@ -64,9 +68,9 @@ void Socket::init(int port) {
 
   // create end point of the socket
   //    AF_INET: IPv4 protocol family
-  //    SOCK_STREAM: TCP
+  //    SOCK_STREAM: TCP (not inherited by cgi worker)
   //    3rd arg: No need to specify protocols more
-  fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
   if (fd_ == -1) {
     throw std::runtime_error("webserv: Socket: cannot initialize socket");
   }
@@ -77,6 +81,17 @@ void Socket::init(int port) {
     throw std::runtime_error("webserv: Socket: cannot initialize socket");
   }
 
+  // let each worker bind its own socket to the port
+  // (kernel distributes incoming connections among them)
+  int optval = 1;
+  if (setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval)) ==
+          -1 ||
+      setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval)) ==
+          -1) {
+    close(fd_);
+    throw std::runtime_error("webserv: Socket: cannot initialize socket");
+  }
+
   // create addressing info
   addr_in_.sin_family = AF_INET;          // specify address family is IPv4
   addr_in_.sin_addr.s_addr = INADDR_ANY;  // accept all IP address
@@ -98,32 +113,40 @@ void Socket::init(int port) {
 
   // initialize address length
   addrlen_ = sizeof(struct sockaddr_in);
+
+  // keep a fd to release when fds run out (see dropRequest)
+  reserve_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
 }
 
 /*
 ** function: acceptRequest
 **
-** accept a request from client and returns connected fd to client
-** accepted functions
+** accept a connection from client and returns connected fd to client
+**    - accepted fd is non blocking and not inherited by cgi process
+**    - returns -1 if error (errno is EAGAIN if no connection left)
 */
 
 int Socket::acceptRequest() {
-  int accepted_fd;
-
-  // accept connection and store new fd
-  accepted_fd =
-      accept(fd_, reinterpret_cast<struct sockaddr *>(&addr_in_), &addrlen_);
-  if (accepted_fd == -1) {
-    std::cout << "[error] failed to accept connection" << std::endl;
-    return -1;
-  }
+  return accept4(fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
 
-  // change fd to non blocking fd
-  if (fcntl(fd_, F_SETFL, O_NONBLOCK) != 0) {
-    close(accepted_fd);
-    throw std::runtime_error("webserv: Socket: cannot initialize socket");
-  }
+/*
+** function: dropRequest
+**
+** accept a connection and close it at once (used when fds run out)
+**    - connection left in queue makes listening socket ready forever,
+**      so reserved fd is released to accept it
+**    - returns -1 if nothing is dropped
+*/
 
-  std::cout << "[webserv] accept connection" << std::endl;
-  return accepted_fd;
+int Socket::dropRequest() {
+  if (reserve_fd_ >= 0) {
+    close(reserve_fd_);
+  }
+  int dropped_fd = accept(fd_, NULL, NULL);
+  if (dropped_fd >= 0) {
+    close(dropped_fd);
+  }
+  reserve_fd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+  return dropped_fd >= 0 ? 0 : -1;
 }
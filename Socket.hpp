@@ -6,7 +6,7 @@
 /*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
 /*                                                +#+#+#+#+#+   +#+           */
 /*   Created: 2021/02/24 15:38:38 by dnakano           #+#    #+#             */
-/*   Updated: 2021/02/24 20:57:49 by dnakano          ###   ########.fr       */
+/*   Updated: 2021/03/15 18:02:45 by dnakano          ###   ########.fr       */
 /*                                                                            */
 /* ************************************************************************** */
 
@@ -22,7 +22,8 @@ class Socket {
   int fd_;                      // socket's fd
   int port_;                    // port number
   struct sockaddr_in addr_in_;  // address of socket (in ipv4)
-  socklen_t addrlen_;           // address byte length (used in accept)
+  socklen_t addrlen_;           // address byte length
+  int reserve_fd_;              // fd released to drop connection
 
   // do not allow copy and assignation
   Socket(const Socket& ref);
@@ -40,6 +41,9 @@ class Socket {
 
   // returns a file discripor of accepted socket (or -1 if error)
   int acceptRequest();
+
+  // accept and close a connection when no fd is left (or -1 if error)
+  int dropRequest();
 };
 
 #endif /* SOCKET_HPP */
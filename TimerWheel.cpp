@@ -0,0 +1,199 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   TimerWheel.cpp                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/15 10:21:54 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/15 14:37:20 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "TimerWheel.hpp"
+
+#include <stddef.h>  // NULL
+
+#include <algorithm>
+
+/*
+** constructor
+**
+** all slots are initialized as empty list
+*/
+
+TimerWheel::TimerWheel() : now_(0), size_(0) {
+  for (int i = 0; i < TIMER_WHEEL_SLOTS0; ++i) {
+    initList(&level0_[i]);
+  }
+  for (int level = 0; level < TIMER_WHEEL_LEVELS - 1; ++level) {
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; ++i) {
+      initList(&levels_[level][i]);
+    }
+  }
+  initList(&expired_);
+}
+
+/*
+** destructor
+**
+** timers are owned by their owners, nothing to free
+*/
+
+TimerWheel::~TimerWheel() {}
+
+/*
+** getter
+*/
+
+bool TimerWheel::empty() const { return size_ == 0; }
+
+/*
+** function: init
+**
+** set current time of wheel
+*/
+
+void TimerWheel::init(time_t now) { now_ = now; }
+
+/*
+** function: initList / link / unlink
+**
+** circular doubly linked list with head node (O(1) insert and remove)
+*/
+
+void TimerWheel::initList(TimerNode* head) {
+  head->prev = head;
+  head->next = head;
+}
+
+void TimerWheel::link(TimerNode* head, TimerNode* node) {
+  node->prev = head->prev;
+  node->next = head;
+  head->prev->next = node;
+  head->prev = node;
+}
+
+void TimerWheel::unlink(TimerNode* node) {
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+  node->prev = NULL;
+  node->next = NULL;
+}
+
+/*
+** function: insert
+**
+** link timer to slot of level decided by time left until expire
+**    - expired timer is put in slot of current tick (fired in next advance)
+**    - timer too far is put in the last slot reachable
+*/
+
+void TimerWheel::insert(TimerNode* node) {
+  const time_t delta_max =
+      (static_cast<time_t>(1)
+       << (TIMER_WHEEL_BITS0 + TIMER_WHEEL_BITS * (TIMER_WHEEL_LEVELS - 1))) -
+      1;
+  time_t expire = std::min(std::max(node->expire, now_), now_ + delta_max);
+  time_t delta = expire - now_;
+
+  if (delta < TIMER_WHEEL_SLOTS0) {
+    link(&level0_[expire & (TIMER_WHEEL_SLOTS0 - 1)], node);
+    return;
+  }
+  for (int level = 0; level < TIMER_WHEEL_LEVELS - 1; ++level) {
+    int shift = TIMER_WHEEL_BITS0 + TIMER_WHEEL_BITS * level;
+    if (delta < (static_cast<time_t>(1) << (shift + TIMER_WHEEL_BITS))) {
+      link(&levels_[level][(expire >> shift) & (TIMER_WHEEL_SLOTS - 1)], node);
+      return;
+    }
+  }
+}
+
+/*
+** function: cascade
+**
+** move timers in slot of upper level to lower levels
+*/
+
+void TimerWheel::cascade(TimerNode* head) {
+  while (head->next != head) {
+    TimerNode* node = head->next;
+    unlink(node);
+    insert(node);
+  }
+}
+
+/*
+** function: arm
+**
+** start timer to fire at expire
+*/
+
+void TimerWheel::arm(TimerNode* node, time_t expire) {
+  cancel(node);
+  node->expire = expire;
+  insert(node);
+  ++size_;
+}
+
+/*
+** function: cancel
+**
+** stop timer if armed
+*/
+
+void TimerWheel::cancel(TimerNode* node) {
+  if (node->prev == NULL) {
+    return;
+  }
+  unlink(node);
+  --size_;
+}
+
+/*
+** function: advance
+**
+** process ticks until now and move timers of processed slots to expired_
+**    - slot of upper level is cascaded when lower level goes around
+**    - no tick has to be processed while no timer is armed
+*/
+
+void TimerWheel::advance(time_t now) {
+  if (size_ == 0 && now >= now_) {
+    now_ = now + 1;
+    return;
+  }
+  while (now_ <= now) {
+    int index = now_ & (TIMER_WHEEL_SLOTS0 - 1);
+    for (int level = 0; index == 0 && level < TIMER_WHEEL_LEVELS - 1;
+         ++level) {
+      int shift = TIMER_WHEEL_BITS0 + TIMER_WHEEL_BITS * level;
+      index = (now_ >> shift) & (TIMER_WHEEL_SLOTS - 1);
+      cascade(&levels_[level][index]);
+    }
+    TimerNode* head = &level0_[now_ & (TIMER_WHEEL_SLOTS0 - 1)];
+    while (head->next != head) {
+      TimerNode* node = head->next;
+      unlink(node);
+      link(&expired_, node);
+    }
+    ++now_;
+  }
+}
+
+/*
+** function: popExpired
+**
+** take one timer fired by advance() (it is no longer armed)
+*/
+
+TimerNode* TimerWheel::popExpired() {
+  if (expired_.next == &expired_) {
+    return NULL;
+  }
+  TimerNode* node = expired_.next;
+  unlink(node);
+  --size_;
+  return node;
+}
@@ -0,0 +1,84 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   TimerWheel.hpp                                     :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/15 10:21:54 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/15 14:37:20 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <time.h>
+
+#include "config.hpp"
+
+// timer linked in slot of TimerWheel (embedded in owner, e.g. Session)
+struct TimerNode {
+  TimerNode* prev;  // NULL if not armed
+  TimerNode* next;
+  time_t expire;    // time to fire (seconds)
+  int key;          // to find owner when fired
+};
+
+/*
+** hierarchical timer wheel (tick is one second)
+**
+** level 0 has a slot for each of next TIMER_WHEEL_SLOTS0 ticks, and each
+** slot of upper levels covers all slots of the level below. timers in an
+** upper level are moved down (cascade) when level 0 goes around, so arm
+** and cancel are O(1) and advance is amortized O(1) for each timer.
+*/
+
+#define TIMER_WHEEL_BITS0 8
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOTS0 (1 << TIMER_WHEEL_BITS0)
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+class TimerWheel {
+ private:
+  TimerNode level0_[TIMER_WHEEL_SLOTS0];  // head of list in each slot
+  TimerNode levels_[TIMER_WHEEL_LEVELS - 1][TIMER_WHEEL_SLOTS];
+  TimerNode expired_;                      // timers fired not popped yet
+  time_t now_;                             // next tick to process
+  size_t size_;                            // number of timers armed
+
+  // do not allow copy and assignation
+  TimerWheel(const TimerWheel& ref);
+  TimerWheel& operator=(const TimerWheel& ref);
+
+  static void initList(TimerNode* head);
+  static void link(TimerNode* head, TimerNode* node);
+  static void unlink(TimerNode* node);
+  void insert(TimerNode* node);
+  void cascade(TimerNode* head);
+
+ public:
+  TimerWheel();
+  ~TimerWheel();
+
+  // getter
+  bool empty() const;
+
+  // function to init wheel (ticks before now are never processed)
+  void init(time_t now);
+
+  // arm timer to fire at expire (re-armed if already armed)
+  void arm(TimerNode* node, time_t expire);
+
+  // cancel timer (nothing is done if not armed)
+  void cancel(TimerNode* node);
+
+  // fire all timers expired by now (pop them by popExpired)
+  void advance(time_t now);
+
+  // returns next timer fired (disarmed) or NULL
+  TimerNode* popExpired();
+};
+
+#endif /* TIMERWHEEL_HPP */
@@ -0,0 +1,190 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Uring.cpp                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/26 14:03:17 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/26 18:20:44 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "Uring.hpp"
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>  // memset
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/*
+** constructor / destructor
+*/
+
+Uring::Uring()
+    : fd_(-1),
+      ring_(MAP_FAILED),
+      ring_size_(0),
+      sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+      sqes_size_(0),
+      sq_head_(NULL),
+      sq_tail_(NULL),
+      sq_mask_(0),
+      sq_entries_(0),
+      cq_head_(NULL),
+      cq_tail_(NULL),
+      cq_mask_(0),
+      cqes_(NULL) {}
+
+Uring::~Uring() { destroy(); }
+
+/*
+** function: init
+**
+** create io_uring instance and map its queues
+**    - kernel must support single mmap of queues and timeout of enter
+**      (5.11 or later), else fails and nothing is left
+**    - completion queue is 4 times larger (completions are not dropped
+**      even if it is full, kernel keeps them until read)
+*/
+
+int Uring::init(unsigned entries) {
+  struct io_uring_params params;
+
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = entries * 4;
+  fd_ = syscall(__NR_io_uring_setup, entries, &params);
+  if (fd_ == -1) {
+    return -1;
+  }
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_EXT_ARG) ||
+      !(params.features & IORING_FEAT_NODROP)) {
+    destroy();
+    errno = ENOSYS;
+    return -1;
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  ring_size_ = sq_size > cq_size ? sq_size : cq_size;
+  ring_ = mmap(NULL, ring_size_, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = static_cast<struct io_uring_sqe*>(
+      mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+           fd_, IORING_OFF_SQES));
+  if (ring_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+    destroy();
+    return -1;
+  }
+
+  char* ring = static_cast<char*>(ring_);
+  sq_head_ = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+  sq_mask_ = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  cq_head_ = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(ring + params.cq_off.cqes);
+
+  // i-th slot always has i-th entry (entries are used in order)
+  unsigned* array = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+  for (unsigned i = 0; i < sq_entries_; ++i) {
+    array[i] = i;
+  }
+  return 0;
+}
+
+/*
+** function: destroy
+**
+** unmap queues and close instance
+*/
+
+void Uring::destroy() {
+  if (sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+    sqes_ = static_cast<struct io_uring_sqe*>(MAP_FAILED);
+  }
+  if (ring_ != MAP_FAILED) {
+    munmap(ring_, ring_size_);
+    ring_ = MAP_FAILED;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+/*
+** function: getSqe
+**
+** returns next entry of submission queue (submitted by next enter)
+**    - entries queued are submitted now if queue is full
+**    - returns NULL if queue is still full
+*/
+
+struct io_uring_sqe* Uring::getSqe() {
+  unsigned tail = *sq_tail_;
+
+  if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+    if (enter(0, 0) == -1 ||
+        tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+      return NULL;
+    }
+  }
+  struct io_uring_sqe* sqe = &sqes_[tail & sq_mask_];
+  memset(sqe, 0, sizeof(*sqe));
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  return sqe;
+}
+
+/*
+** function: enter
+**
+** one system call to submit all entries queued and wait for completions
+**    - timeout and EINTR are not errors (returns 0)
+**    - EBUSY means completions are kept by kernel, read them first
+*/
+
+int Uring::enter(unsigned min_complete, int timeout_ms) {
+  unsigned to_submit =
+      *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+
+  memset(&arg, 0, sizeof(arg));
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+  arg.ts = reinterpret_cast<uintptr_t>(&ts);
+  if (syscall(__NR_io_uring_enter, fd_, to_submit, min_complete,
+              IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+              sizeof(arg)) == -1 &&
+      errno != ETIME && errno != EINTR && errno != EBUSY) {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+** function: peekCqe / seenCqe
+*/
+
+struct io_uring_cqe* Uring::peekCqe() {
+  unsigned head = *cq_head_;
+
+  if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return &cqes_[head & cq_mask_];
+}
+
+void Uring::seenCqe() {
+  __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,69 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   Uring.hpp                                          :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/26 14:03:17 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/26 18:20:44 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <linux/io_uring.h>
+#include <stddef.h>  // size_t
+
+/*
+** io_uring instance used by raw system calls (no liburing)
+**
+** entries are put to submission queue by getSqe() and submitted all at
+** once by enter(), which also waits for completions. completions are read
+** from completion queue by peekCqe() and seenCqe(). both queues are shared
+** with kernel by mmap, so no system call is needed to fill or read them.
+*/
+
+class Uring {
+ private:
+  int fd_;                      // fd of io_uring instance (-1 if none)
+  void* ring_;                  // mmap of both queues
+  size_t ring_size_;            // size of ring_
+  struct io_uring_sqe* sqes_;   // mmap of submission queue entries
+  size_t sqes_size_;            // size of sqes_
+  unsigned* sq_head_;           // (written by kernel)
+  unsigned* sq_tail_;           // (written by us)
+  unsigned sq_mask_;            // mask of index of submission queue
+  unsigned sq_entries_;         // size of submission queue
+  unsigned* cq_head_;           // (written by us)
+  unsigned* cq_tail_;           // (written by kernel)
+  unsigned cq_mask_;            // mask of index of completion queue
+  struct io_uring_cqe* cqes_;   // completion queue entries
+
+  // do not allow copy and assignation
+  Uring(const Uring& ref);
+  Uring& operator=(const Uring& ref);
+
+  void destroy();
+
+ public:
+  Uring();
+  ~Uring();
+
+  // create instance with entries (returns -1 if io_uring is not available)
+  int init(unsigned entries);
+
+  // returns cleared entry to submit (queue is submitted if full)
+  struct io_uring_sqe* getSqe();
+
+  // submit queued entries and wait until min_complete entries completed
+  // or timeout_ms passed (returns -1 if error)
+  int enter(unsigned min_complete, int timeout_ms);
+
+  // returns first completion not seen yet (or NULL), seenCqe() after use
+  struct io_uring_cqe* peekCqe();
+  void seenCqe();
+};
+
+#endif /* URING_HPP */
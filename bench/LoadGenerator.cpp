@@ -0,0 +1,456 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   LoadGenerator.cpp                                  :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/18 11:12:45 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/23 21:40:12 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "LoadGenerator.hpp"
+
+#include <arpa/inet.h>   // htons
+#include <errno.h>
+#include <netinet/in.h>  // sockaddr_in
+#include <string.h>      // strncasecmp
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>    // clock_gettime
+#include <unistd.h>  // close
+
+#include <cctype>   // isxdigit
+#include <cstdlib>  // strtoul
+#include <sstream>
+#include <stdexcept>
+
+// max number of events to receive by one epoll_wait
+#define BENCH_MAX_EVENTS 256
+
+// time to wait events at once (in msec, closed connections are retried)
+#define BENCH_WAIT_MS 10
+
+// size of buffer to receive response (body is discarded)
+#define BENCH_RECV_SIZE 65536
+
+// max size of response line and headers
+#define BENCH_HEADER_MAX 16384
+
+/*
+** constructor
+**
+** build request of scenario and create epoll instance
+**    - body is filled with printable pattern (same in every run)
+*/
+
+LoadGenerator::LoadGenerator(int port, const BenchScenario& scenario,
+                             int n_conn)
+    : port_(port),
+      scenario_(scenario),
+      epoll_fd_(-1),
+      conns_(n_conn),
+      recv_buf_(BENCH_RECV_SIZE),
+      measure_from_(0),
+      measure_to_(0),
+      result_(NULL) {
+  std::ostringstream request;
+
+  request << scenario.method << " " << scenario.target << " HTTP/1.1\r\n"
+          << "Host: localhost\r\n";
+  if (scenario.body_size > 0) {
+    request << "Content-Length: " << scenario.body_size << "\r\n";
+  }
+  if (!scenario.keep_alive) {
+    request << "Connection: close\r\n";
+  }
+  request << "\r\n";
+  request_ = request.str();
+  for (size_t i = 0; i < scenario.body_size; ++i) {
+    request_ += static_cast<char>('a' + i % 26);
+  }
+
+  for (size_t i = 0; i < conns_.size(); ++i) {
+    conns_[i].fd = -1;
+    conns_[i].events = 0;
+  }
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ == -1) {
+    throw std::runtime_error("webserv_bench: cannot create epoll instance");
+  }
+}
+
+/*
+** destructor
+**
+** close connections left and epoll instance
+*/
+
+LoadGenerator::~LoadGenerator() {
+  for (size_t i = 0; i < conns_.size(); ++i) {
+    closeConnection(&conns_[i]);
+  }
+  if (epoll_fd_ != -1) {
+    close(epoll_fd_);
+  }
+}
+
+/*
+** function: getTimeUs
+*/
+
+unsigned long LoadGenerator::getTimeUs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<unsigned long>(ts.tv_sec) * 1000000UL +
+         static_cast<unsigned long>(ts.tv_nsec) / 1000UL;
+}
+
+/*
+** function: isMeasuring
+**
+** check if results at the time are recorded (not in warmup)
+*/
+
+bool LoadGenerator::isMeasuring(unsigned long now) const {
+  return now >= measure_from_ && now < measure_to_;
+}
+
+/*
+** function: watch
+**
+** change events of connection watched by epoll (only if changed)
+*/
+
+void LoadGenerator::watch(Connection* conn, uint32_t events) {
+  if (conn->events == events) {
+    return;
+  }
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.ptr = conn;
+  epoll_ctl(epoll_fd_, conn->events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+            conn->fd, &ev);
+  conn->events = events;
+}
+
+/*
+** function: openConnection
+**
+** start connecting to server on loopback (completed in sendRequest)
+**    - fd is left -1 if failed, and retried in next loop of run
+*/
+
+void LoadGenerator::openConnection(Connection* conn) {
+  struct sockaddr_in addr;
+
+  conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (conn->fd == -1) {
+    return;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port_);
+
+  // latency of request on new connection includes connecting
+  startRequest(conn, getTimeUs());
+  if (connect(conn->fd, reinterpret_cast<struct sockaddr*>(&addr),
+              sizeof(addr)) == -1 &&
+      errno != EINPROGRESS) {
+    failConnection(conn);
+    return;
+  }
+  watch(conn, EPOLLOUT);
+}
+
+/*
+** function: closeConnection
+*/
+
+void LoadGenerator::closeConnection(Connection* conn) {
+  if (conn->fd != -1) {
+    close(conn->fd);  // also removed from epoll
+  }
+  conn->fd = -1;
+  conn->events = 0;
+}
+
+/*
+** function: failConnection
+**
+** count an error and close connection (reopened in next loop of run)
+*/
+
+void LoadGenerator::failConnection(Connection* conn) {
+  if (result_ != NULL && isMeasuring(getTimeUs())) {
+    ++result_->errors;
+  }
+  closeConnection(conn);
+}
+
+/*
+** function: startRequest
+**
+** reset state of connection for next request
+*/
+
+void LoadGenerator::startRequest(Connection* conn, unsigned long now) {
+  conn->sent = 0;
+  conn->header.clear();
+  conn->header_done = false;
+  conn->body_left = 0;
+  conn->chunked = false;
+  conn->chunk_state = CHUNK_SIZE;
+  conn->line_len = 0;
+  conn->status = 0;
+  conn->close_after = false;
+  conn->start_us = now;
+}
+
+/*
+** function: sendRequest
+**
+** send rest of request and wait for response when all of it is sent
+*/
+
+void LoadGenerator::sendRequest(Connection* conn) {
+  while (conn->sent < request_.size()) {
+    ssize_t n = send(conn->fd, request_.data() + conn->sent,
+                     request_.size() - conn->sent, MSG_NOSIGNAL);
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        watch(conn, EPOLLOUT);
+        return;
+      }
+      failConnection(conn);  // e.g. connection refused
+      return;
+    }
+    conn->sent += n;
+  }
+  watch(conn, EPOLLIN);
+}
+
+/*
+** function: recvResponse
+**
+** receive a part of response and complete it when whole body is received
+**    - body is counted and discarded (not kept in memory)
+*/
+
+void LoadGenerator::recvResponse(Connection* conn) {
+  ssize_t n = recv(conn->fd, &recv_buf_[0], recv_buf_.size(), 0);
+  if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;
+  } else if (n <= 0) {  // closed before response is completed
+    failConnection(conn);
+    return;
+  }
+  if (isMeasuring(getTimeUs())) {
+    result_->bytes += n;
+  }
+
+  const char* body = &recv_buf_[0];
+  size_t body_len = n;
+  if (!conn->header_done) {
+    size_t searched = conn->header.size() < 3 ? 0 : conn->header.size() - 3;
+    conn->header.append(&recv_buf_[0], n);
+    size_t end = conn->header.find("\r\n\r\n", searched);
+    if (end == std::string::npos) {
+      if (conn->header.size() > BENCH_HEADER_MAX) {
+        failConnection(conn);
+      }
+      return;
+    }
+    if (parseHeader(conn) == -1) {
+      failConnection(conn);
+      return;
+    }
+    body = conn->header.data() + end + 4;
+    body_len = conn->header.size() - (end + 4);
+  }
+  if (conn->chunked) {
+    int ret = parseChunks(conn, body, body_len);
+    if (ret == -1) {
+      failConnection(conn);
+    } else if (ret == 1) {
+      completeResponse(conn);
+    }
+    return;
+  }
+  conn->body_left -= body_len < conn->body_left ? body_len : conn->body_left;
+  if (conn->body_left == 0) {
+    completeResponse(conn);
+  }
+}
+
+/*
+** function: parseHeader
+**
+** read status code, Content-Length (or chunked) and Connection of response
+**    - returns -1 if response is not valid (or its length is unknown)
+*/
+
+int LoadGenerator::parseHeader(Connection* conn) {
+  const std::string& header = conn->header;
+  bool has_length = false;
+
+  if (header.compare(0, 5, "HTTP/") != 0 || header.size() < 12) {
+    return -1;
+  }
+  conn->status = std::atoi(header.c_str() + 9);
+
+  size_t pos = header.find("\r\n") + 2;
+  while (pos < header.size() && header.compare(pos, 2, "\r\n") != 0) {
+    size_t eol = header.find("\r\n", pos);
+    const char* line = header.c_str() + pos;
+    if (strncasecmp(line, "Content-Length:", 15) == 0) {
+      conn->body_left = std::strtoul(line + 15, NULL, 10);
+      has_length = true;
+    } else if (strncasecmp(line, "Transfer-Encoding:", 18) == 0 &&
+               header.find("chunked", pos) < eol) {
+      conn->chunked = true;
+      has_length = true;
+    } else if (strncasecmp(line, "Connection:", 11) == 0 &&
+               header.find("close", pos) < eol) {
+      conn->close_after = true;
+    }
+    pos = eol + 2;
+  }
+  conn->header_done = true;
+  return has_length ? 0 : -1;
+}
+
+/*
+** function: parseChunks
+**
+** skip a part of chunked body (chunk data is counted, not kept)
+** returns 1 if the last chunk and trailer are received, 0 if not yet,
+** -1 if size line is broken
+*/
+
+int LoadGenerator::parseChunks(Connection* conn, const char* data,
+                               size_t len) {
+  const char* end = data + len;
+
+  while (data < end) {
+    char c = *data;
+    switch (conn->chunk_state) {
+      case CHUNK_SIZE:
+        if (std::isxdigit(c) && conn->line_len < 15) {
+          conn->body_left = conn->body_left * 16 +
+                            (std::isdigit(c) ? c - '0'
+                                             : std::tolower(c) - 'a' + 10);
+          ++conn->line_len;
+          ++data;
+          break;
+        } else if (conn->line_len == 0) {
+          return -1;
+        }
+        conn->chunk_state = CHUNK_SIZE_EXT;  // parse c again
+        break;
+      case CHUNK_SIZE_EXT:
+        if (c == '\n') {
+          conn->line_len = 0;
+          conn->chunk_state =
+              conn->body_left == 0 ? CHUNK_TRAILER : CHUNK_DATA;
+        }
+        ++data;
+        break;
+      case CHUNK_DATA: {
+        size_t n = static_cast<size_t>(end - data);
+        n = n < conn->body_left ? n : conn->body_left;
+        conn->body_left -= n;
+        data += n;
+        if (conn->body_left == 0) {
+          conn->chunk_state = CHUNK_DATA_LF;
+        }
+        break;
+      }
+      case CHUNK_DATA_LF:
+        if (c == '\n') {
+          conn->chunk_state = CHUNK_SIZE;
+        }
+        ++data;
+        break;
+      case CHUNK_TRAILER:
+        ++data;
+        if (c == '\n' && conn->line_len == 0) {
+          return 1;
+        } else if (c == '\n') {
+          conn->line_len = 0;
+        } else if (c != '\r') {
+          ++conn->line_len;
+        }
+        break;
+    }
+  }
+  return 0;
+}
+
+/*
+** function: completeResponse
+**
+** record latency of request and send next one
+**    - new connection is opened if connection is not kept
+*/
+
+void LoadGenerator::completeResponse(Connection* conn) {
+  unsigned long now = getTimeUs();
+
+  if (isMeasuring(now)) {
+    ++result_->requests;
+    result_->latencies_us.push_back(now - conn->start_us);
+    if (conn->status / 100 != 2) {
+      ++result_->non_2xx;
+    }
+  }
+  if (!scenario_.keep_alive || conn->close_after) {
+    closeConnection(conn);
+    openConnection(conn);
+    return;
+  }
+  startRequest(conn, now);
+  sendRequest(conn);
+}
+
+/*
+** function: run
+**
+** drive all connections until warmup and measured time are over
+*/
+
+void LoadGenerator::run(unsigned long warmup_us, unsigned long duration_us,
+                        BenchResult* result) {
+  struct epoll_event events[BENCH_MAX_EVENTS];
+
+  result_ = result;
+  measure_from_ = getTimeUs() + warmup_us;
+  measure_to_ = measure_from_ + duration_us;
+
+  while (getTimeUs() < measure_to_) {
+    // (re)open connections closed
+    for (size_t i = 0; i < conns_.size(); ++i) {
+      if (conns_[i].fd == -1) {
+        openConnection(&conns_[i]);
+      }
+    }
+
+    int n_event =
+        epoll_wait(epoll_fd_, events, BENCH_MAX_EVENTS, BENCH_WAIT_MS);
+    for (int i = 0; i < n_event; ++i) {
+      Connection* conn = static_cast<Connection*>(events[i].data.ptr);
+      if (conn->events == EPOLLOUT) {
+        sendRequest(conn);
+      } else {
+        recvResponse(conn);
+      }
+    }
+  }
+  for (size_t i = 0; i < conns_.size(); ++i) {
+    closeConnection(&conns_[i]);
+  }
+  result_ = NULL;
+}
@@ -0,0 +1,114 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   LoadGenerator.hpp                                  :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/18 11:12:45 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/23 21:40:12 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef LOADGENERATOR_HPP
+#define LOADGENERATOR_HPP
+
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint32_t
+
+#include <string>
+#include <vector>
+
+// request sent repeatedly in a run of benchmark
+struct BenchScenario {
+  const char* name;
+  const char* method;
+  const char* target;
+  size_t body_size;  // bytes of request body (0 means no body)
+  bool keep_alive;   // reuse connection (or "Connection: close")
+};
+
+// result of a run (latencies are of requests completed in measured time)
+struct BenchResult {
+  unsigned long requests;  // responses received completely
+  unsigned long errors;    // connections failed or closed in a response
+  unsigned long non_2xx;   // responses with status other than 2xx
+  unsigned long bytes;     // bytes received
+  std::vector<unsigned long> latencies_us;
+};
+
+/*
+** load generator driving the server over loopback from one thread
+**
+** keeps n_conn non blocking connections busy with one request each,
+** and opens a new connection when one is closed. time from sending a
+** request (or connecting, if connection is new) until its response is
+** received completely is recorded as latency of the request.
+*/
+
+class LoadGenerator {
+ private:
+  // state of parsing chunked body
+  enum ChunkState {
+    CHUNK_SIZE,      // hex digits of size line
+    CHUNK_SIZE_EXT,  // rest of size line (extensions are skipped)
+    CHUNK_DATA,      // chunk data (body_left is bytes left)
+    CHUNK_DATA_LF,   // CRLF after chunk data
+    CHUNK_TRAILER    // trailer fields until empty line
+  };
+
+  // state of one connection
+  struct Connection {
+    int fd;
+    uint32_t events;       // events watched by epoll
+    size_t sent;           // bytes of request sent
+    std::string header;    // response line and headers received so far
+    bool header_done;      // header is received (body_left is valid)
+    size_t body_left;      // bytes of response body not received yet
+    bool chunked;          // body is chunked (body_left is of chunk)
+    ChunkState chunk_state;
+    size_t line_len;       // bytes of size or trailer line read
+    int status;            // status code of response
+    bool close_after;      // server closes connection after response
+    unsigned long start_us;
+  };
+
+  int port_;
+  const BenchScenario& scenario_;
+  std::string request_;  // request sent by all connections
+  int epoll_fd_;
+  std::vector<Connection> conns_;
+  std::vector<char> recv_buf_;
+  unsigned long measure_from_;  // completions before this are not counted
+  unsigned long measure_to_;
+  BenchResult* result_;
+
+  // do not allow copy and assignation
+  LoadGenerator(const LoadGenerator& ref);
+  LoadGenerator& operator=(const LoadGenerator& ref);
+
+  void watch(Connection* conn, uint32_t events);
+  void openConnection(Connection* conn);
+  void closeConnection(Connection* conn);
+  void failConnection(Connection* conn);
+  bool isMeasuring(unsigned long now) const;
+  void startRequest(Connection* conn, unsigned long now);
+  void sendRequest(Connection* conn);
+  void recvResponse(Connection* conn);
+  int parseHeader(Connection* conn);
+  static int parseChunks(Connection* conn, const char* data, size_t len);
+  void completeResponse(Connection* conn);
+
+ public:
+  LoadGenerator(int port, const BenchScenario& scenario, int n_conn);
+  ~LoadGenerator();
+
+  // returns current time of monotonic clock in usec
+  static unsigned long getTimeUs();
+
+  // send requests for warmup_us and record results for duration_us
+  void run(unsigned long warmup_us, unsigned long duration_us,
+           BenchResult* result);
+};
+
+#endif /* LOADGENERATOR_HPP */
@@ -0,0 +1,487 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   main.cpp                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/18 11:12:45 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/28 18:10:00 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include <arpa/inet.h>   // htons
+#include <fcntl.h>       // open
+#include <netinet/in.h>  // sockaddr_in
+#include <pthread.h>
+#include <string.h>      // memset, strcmp, strncmp
+#include <sys/socket.h>
+#include <sys/stat.h>    // mkdir
+#include <unistd.h>      // getopt, usleep, rmdir
+
+#include <algorithm>  // sort
+#include <cstdio>
+#include <cstdlib>  // atoi
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "../config.hpp"
+#include "LoadGenerator.hpp"
+
+// connections kept open by all threads in a scenario
+#define BENCH_CONNECTIONS 64
+
+// threads to drive connections (they are shared evenly)
+#define BENCH_THREADS 2
+
+// seconds to send requests before measuring
+#define BENCH_WARMUP_SEC 1
+
+// seconds to measure in a scenario
+#define BENCH_DURATION_SEC 5
+
+// seconds to wait for server to accept connections
+#define BENCH_WAIT_SERVER_SEC 5
+
+// file created in document root and served as a large file
+#define BENCH_LARGE_FILE "bench_large.bin"
+#define BENCH_LARGE_SIZE 8388608
+
+// file written by upload scenario (in UPLOAD_DIR)
+#define BENCH_UPLOAD_FILE "bench_upload.bin"
+
+// directory made in UPLOAD_DIR to check that upload does not replace it
+#define BENCH_UPLOAD_DIR "bench_dir"
+
+// file to write result to (in json)
+#define BENCH_OUTPUT "bench_result.json"
+
+/*
+** scenarios run by default in this order
+**    - all of them are run with the same connections and durations,
+**      so results of different builds can be compared one by one
+*/
+
+static const BenchScenario g_scenarios[] = {
+    {"small_keepalive", "GET", "/" INDEX_FILE, 0, true},
+    {"small_close", "GET", "/" INDEX_FILE, 0, false},
+    {"large_keepalive", "GET", "/" BENCH_LARGE_FILE, 0, true},
+    {"cgi_keepalive", "POST", CGI_PATH_PREFIX, 1024, true},
+    {"upload_keepalive", "PUT", UPLOAD_DIR BENCH_UPLOAD_FILE, 65536, true},
+};
+
+static const size_t g_n_scenario = sizeof(g_scenarios) / sizeof(g_scenarios[0]);
+
+// options of a run
+struct BenchOption {
+  int port;
+  int connections;
+  int threads;
+  int warmup_sec;
+  int duration_sec;
+  std::string output;
+};
+
+// arguments of a thread driving a part of connections
+struct BenchThread {
+  const BenchOption* option;
+  const BenchScenario* scenario;
+  int n_conn;
+  BenchResult result;
+};
+
+/*
+** function: runThread
+**
+** thread routine to run load generator on its connections
+*/
+
+static void* runThread(void* arg) {
+  BenchThread* thread = static_cast<BenchThread*>(arg);
+  try {
+    LoadGenerator generator(thread->option->port, *thread->scenario,
+                            thread->n_conn);
+    generator.run(thread->option->warmup_sec * 1000000UL,
+                  thread->option->duration_sec * 1000000UL, &thread->result);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+  }
+  return NULL;
+}
+
+/*
+** function: runScenario
+**
+** run a scenario on all threads and merge their results
+*/
+
+static void runScenario(const BenchOption& option,
+                        const BenchScenario& scenario, BenchResult* result) {
+  std::vector<BenchThread> threads(option.threads);
+  std::vector<pthread_t> ids(option.threads);
+
+  for (int i = 0; i < option.threads; ++i) {
+    threads[i].option = &option;
+    threads[i].scenario = &scenario;
+    threads[i].n_conn = option.connections / option.threads +
+                        (i < option.connections % option.threads ? 1 : 0);
+    threads[i].result = BenchResult();
+  }
+  int n_started = 0;
+  for (; n_started < option.threads; ++n_started) {
+    if (pthread_create(&ids[n_started], NULL, runThread,
+                       &threads[n_started]) != 0) {
+      std::cerr << "webserv_bench: cannot start thread" << std::endl;
+      break;
+    }
+  }
+
+  *result = BenchResult();
+  for (int i = 0; i < n_started; ++i) {
+    pthread_join(ids[i], NULL);
+    result->requests += threads[i].result.requests;
+    result->errors += threads[i].result.errors;
+    result->non_2xx += threads[i].result.non_2xx;
+    result->bytes += threads[i].result.bytes;
+    result->latencies_us.insert(result->latencies_us.end(),
+                                threads[i].result.latencies_us.begin(),
+                                threads[i].result.latencies_us.end());
+  }
+  std::sort(result->latencies_us.begin(), result->latencies_us.end());
+}
+
+/*
+** function: getPercentile
+**
+** returns latency at percentile p of sorted latencies (0 if empty)
+*/
+
+static unsigned long getPercentile(const std::vector<unsigned long>& sorted,
+                                   double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t idx = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+/*
+** function: writeResult
+**
+** write result of a scenario as an element of "scenarios" in json
+*/
+
+static void writeResult(std::ostream& out, const BenchOption& option,
+                        const BenchScenario& scenario,
+                        const BenchResult& result) {
+  const std::vector<unsigned long>& lat = result.latencies_us;
+  double sec = option.duration_sec;
+  unsigned long sum = 0;
+
+  for (size_t i = 0; i < lat.size(); ++i) {
+    sum += lat[i];
+  }
+  out << "    {\"name\": \"" << scenario.name << "\", \"method\": \""
+      << scenario.method << "\", \"target\": \"" << scenario.target
+      << "\", \"body_size\": " << scenario.body_size
+      << ", \"keep_alive\": " << (scenario.keep_alive ? "true" : "false")
+      << ",\n     \"requests\": " << result.requests
+      << ", \"errors\": " << result.errors
+      << ", \"non_2xx\": " << result.non_2xx
+      << ", \"req_per_sec\": " << result.requests / sec
+      << ", \"recv_bytes_per_sec\": "
+      << static_cast<unsigned long>(result.bytes / sec)
+      << ",\n     \"latency_us\": {\"min\": " << (lat.empty() ? 0 : lat[0])
+      << ", \"mean\": " << (lat.empty() ? 0 : sum / lat.size())
+      << ", \"p50\": " << getPercentile(lat, 50)
+      << ", \"p90\": " << getPercentile(lat, 90)
+      << ", \"p99\": " << getPercentile(lat, 99)
+      << ", \"p999\": " << getPercentile(lat, 99.9)
+      << ", \"max\": " << (lat.empty() ? 0 : lat.back()) << "}}";
+}
+
+/*
+** function: connectServer
+**
+** returns blocking socket connected to server (or -1 if failed)
+*/
+
+static int connectServer(int port) {
+  struct sockaddr_in addr;
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if (fd == -1) {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ==
+      -1) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/*
+** function: waitServer
+**
+** wait until server accepts a connection (returns -1 if timed out)
+*/
+
+static int waitServer(int port) {
+  for (int i = 0; i < BENCH_WAIT_SERVER_SEC * 10; ++i) {
+    int fd = connectServer(port);
+    if (fd >= 0) {
+      close(fd);
+      return 0;
+    }
+    usleep(100000);
+  }
+  return -1;
+}
+
+/*
+** function: getPutStatus
+**
+** returns status code of response to a small PUT to target (or -1)
+*/
+
+static int getPutStatus(int port, const std::string& target) {
+  std::string request = "PUT " + target +
+                        " HTTP/1.1\r\nContent-Length: 5\r\n"
+                        "Connection: close\r\n\r\nbench";
+  char status_line[32];
+  size_t len = 0;
+  int fd = connectServer(port);
+
+  if (fd == -1) {
+    return -1;
+  }
+  if (write(fd, request.data(), request.size()) !=
+      static_cast<ssize_t>(request.size())) {
+    close(fd);
+    return -1;
+  }
+  while (len < sizeof(status_line) - 1) {
+    ssize_t n = read(fd, status_line + len, sizeof(status_line) - 1 - len);
+    if (n <= 0) {
+      break;
+    }
+    len += n;
+  }
+  close(fd);
+  status_line[len] = '\0';
+  if (strncmp(status_line, "HTTP/1.1 ", 9) != 0) {
+    return -1;
+  }
+  return std::atoi(status_line + 9);
+}
+
+/*
+** function: checkUploadConfined
+**
+** check that server refuses PUT which would replace a file outside
+** UPLOAD_DIR or a directory in it (returns -1 if accepted)
+*/
+
+static int checkUploadConfined(int port) {
+  std::string dir = DOCUMENT_ROOT UPLOAD_DIR BENCH_UPLOAD_DIR;
+  int outside = getPutStatus(port, "/" INDEX_FILE);
+
+  mkdir(dir.c_str(), 0755);
+  int not_regular = getPutStatus(port, UPLOAD_DIR BENCH_UPLOAD_DIR);
+  rmdir(dir.c_str());
+  if (outside != 403 || not_regular != 403) {
+    std::cerr << "webserv_bench: upload is not confined (PUT /" INDEX_FILE
+              << ": " << outside << ", PUT " UPLOAD_DIR BENCH_UPLOAD_DIR
+              << ": " << not_regular << ")" << std::endl;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+** function: createLargeFile
+**
+** create file served by large file scenario (same content in every run)
+*/
+
+static int createLargeFile() {
+  std::string path = std::string(DOCUMENT_ROOT) + "/" BENCH_LARGE_FILE;
+  std::vector<char> block(65536);
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+  if (fd == -1) {
+    return -1;
+  }
+  for (size_t i = 0; i < block.size(); ++i) {
+    block[i] = static_cast<char>('a' + i % 26);
+  }
+  for (size_t n = 0; n < BENCH_LARGE_SIZE; n += block.size()) {
+    if (write(fd, &block[0], block.size()) != (ssize_t)block.size()) {
+      close(fd);
+      return -1;
+    }
+  }
+  close(fd);
+  return 0;
+}
+
+/*
+** function: removeFiles
+**
+** remove files created by scenarios
+*/
+
+static void removeFiles() {
+  unlink((std::string(DOCUMENT_ROOT) + "/" BENCH_LARGE_FILE).c_str());
+  unlink(DOCUMENT_ROOT UPLOAD_DIR BENCH_UPLOAD_FILE);
+}
+
+/*
+** function: parseOption
+**
+** parse options and returns index of first scenario name in argv
+** (returns -1 if option is invalid)
+*/
+
+static int parseOption(int argc, char** argv, BenchOption* option) {
+  int c;
+
+  option->port = DEFAULT_PORT;
+  option->connections = BENCH_CONNECTIONS;
+  option->threads = BENCH_THREADS;
+  option->warmup_sec = BENCH_WARMUP_SEC;
+  option->duration_sec = BENCH_DURATION_SEC;
+  option->output = BENCH_OUTPUT;
+  while ((c = getopt(argc, argv, "p:c:t:w:d:o:")) != -1) {
+    switch (c) {
+      case 'p':
+        option->port = std::atoi(optarg);
+        break;
+      case 'c':
+        option->connections = std::atoi(optarg);
+        break;
+      case 't':
+        option->threads = std::atoi(optarg);
+        break;
+      case 'w':
+        option->warmup_sec = std::atoi(optarg);
+        break;
+      case 'd':
+        option->duration_sec = std::atoi(optarg);
+        break;
+      case 'o':
+        option->output = optarg;
+        break;
+      default:
+        return -1;
+    }
+  }
+  if (option->connections < 1 || option->threads < 1 ||
+      option->warmup_sec < 0 || option->duration_sec < 1) {
+    return -1;
+  }
+  if (option->threads > option->connections) {
+    option->threads = option->connections;
+  }
+  return optind;
+}
+
+/*
+** function: findScenario
+*/
+
+static const BenchScenario* findScenario(const char* name) {
+  for (size_t i = 0; i < g_n_scenario; ++i) {
+    if (strcmp(g_scenarios[i].name, name) == 0) {
+      return &g_scenarios[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+** load generator of mini_webserv
+**
+** usage: webserv_bench [-p port] [-c connections] [-t threads]
+**                      [-w warmup_sec] [-d duration_sec] [-o output]
+**                      [scenario ...]
+**    - runs all scenarios if none is specified
+**    - fails first if server accepts upload it must refuse
+**    - server must be running with the same DOCUMENT_ROOT (see make bench)
+*/
+
+int main(int argc, char** argv) {
+  BenchOption option;
+  std::vector<const BenchScenario*> scenarios;
+
+  int idx = parseOption(argc, argv, &option);
+  if (idx == -1) {
+    std::cerr << "usage: webserv_bench [-p port] [-c connections] "
+                 "[-t threads] [-w warmup_sec] [-d duration_sec] "
+                 "[-o output] [scenario ...]"
+              << std::endl;
+    return 1;
+  }
+  for (; idx < argc; ++idx) {
+    const BenchScenario* scenario = findScenario(argv[idx]);
+    if (scenario == NULL) {
+      std::cerr << "webserv_bench: unknown scenario: " << argv[idx]
+                << std::endl;
+      return 1;
+    }
+    scenarios.push_back(scenario);
+  }
+  if (scenarios.empty()) {
+    for (size_t i = 0; i < g_n_scenario; ++i) {
+      scenarios.push_back(&g_scenarios[i]);
+    }
+  }
+
+  if (waitServer(option.port) == -1) {
+    std::cerr << "webserv_bench: server is not running on port "
+              << option.port << std::endl;
+    return 1;
+  }
+  if (checkUploadConfined(option.port) == -1) {
+    return 1;
+  }
+  if (createLargeFile() == -1) {
+    std::cerr << "webserv_bench: cannot create " BENCH_LARGE_FILE << std::endl;
+    return 1;
+  }
+
+  std::ofstream out(option.output.c_str());
+  out << "{\"port\": " << option.port
+      << ", \"connections\": " << option.connections
+      << ", \"threads\": " << option.threads
+      << ", \"warmup_sec\": " << option.warmup_sec
+      << ", \"duration_sec\": " << option.duration_sec
+      << ",\n  \"scenarios\": [\n";
+  for (size_t i = 0; i < scenarios.size(); ++i) {
+    BenchResult result;
+    runScenario(option, *scenarios[i], &result);
+    writeResult(out, option, *scenarios[i], result);
+    out << (i + 1 < scenarios.size() ? ",\n" : "\n");
+
+    std::printf("%-18s %10.1f req/s  p50 %7lu us  p99 %7lu us  errors %lu\n",
+                scenarios[i]->name,
+                static_cast<double>(result.requests) / option.duration_sec,
+                getPercentile(result.latencies_us, 50),
+                getPercentile(result.latencies_us, 99), result.errors);
+    std::fflush(stdout);
+  }
+  out << "  ]}\n";
+  removeFiles();
+  if (!out) {
+    std::cerr << "webserv_bench: cannot write " << option.output << std::endl;
+    return 1;
+  }
+  return 0;
+}
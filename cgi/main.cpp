@@ -0,0 +1,155 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   main.cpp                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/19 10:31:27 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/19 17:44:09 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include <errno.h>
+#include <stdlib.h>  // abort
+#include <unistd.h>  // read, write
+
+#include <map>
+#include <string>
+
+#include "../FastCgi.hpp"
+
+/*
+** stand-in cgi worker of mini_webserv
+**
+** started by server with a connected unix socket as fd 0, and processes
+** requests in FastCGI records one after another on it until closed.
+** output is the request body shown like "cat -e" (what cgi of server did
+** before workers).
+**    - QUERY_STRING "crash" makes worker abort (to test restart of worker)
+*/
+
+/*
+** function: readFull
+**
+** read len bytes (returns -1 if closed or failed)
+*/
+
+static int readFull(int fd, char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = read(fd, buf, len);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+** function: writeFull
+*/
+
+static int writeFull(int fd, const char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    } else if (n == -1) {
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+** function: showNonPrinting
+**
+** returns data shown like "cat -e" (-v with $ at end of each line)
+*/
+
+static std::string showNonPrinting(const std::string& data) {
+  std::string out;
+
+  for (size_t i = 0; i < data.size(); ++i) {
+    unsigned char c = data[i];
+    if (c == '\n') {
+      out += "$\n";
+      continue;
+    }
+    if (c >= 128) {
+      out += "M-";
+      c -= 128;
+    }
+    if (c < 32 && c != '\t') {
+      out += '^';
+      out += static_cast<char>(c + 64);
+    } else if (c == 127) {
+      out += "^?";
+    } else {
+      out += static_cast<char>(c);
+    }
+  }
+  return out;
+}
+
+/*
+** function: respond
+**
+** write response of a request received completely
+*/
+
+static int respond(const std::string& params, const std::string& body) {
+  std::map<std::string, std::string> env;
+  std::string out;
+
+  if (parseFcgiParams(params, &env) == -1) {
+    return -1;
+  } else if (env["QUERY_STRING"] == "crash") {
+    abort();
+  }
+  std::string output = showNonPrinting(body);
+  if (!output.empty()) {
+    appendFcgiRecord(&out, FCGI_STDOUT, output.data(), output.size());
+  }
+  appendFcgiRecord(&out, FCGI_STDOUT, "", 0);
+  appendFcgiEndRequest(&out, 0, FCGI_REQUEST_COMPLETE);
+  return writeFull(0, out.data(), out.size());
+}
+
+int main(void) {
+  char header[FCGI_HEADER_LEN];
+  std::string content;
+  std::string params;
+  std::string body;
+  FcgiHeader record;
+
+  // body is read until its end before responding (like most FastCGI apps)
+  while (readFull(0, header, FCGI_HEADER_LEN) == 0) {
+    if (parseFcgiHeader(header, &record) == -1) {
+      return 1;
+    }
+    content.resize(record.content_length + record.padding_length);
+    if (!content.empty() && readFull(0, &content[0], content.size()) == -1) {
+      return 1;
+    }
+    content.resize(record.content_length);
+
+    if (record.type == FCGI_BEGIN_REQUEST) {
+      params.clear();
+      body.clear();
+    } else if (record.type == FCGI_PARAMS) {
+      params += content;
+    } else if (record.type == FCGI_STDIN && !content.empty()) {
+      body += content;
+    } else if (record.type == FCGI_STDIN && respond(params, body) == -1) {
+      return 1;
+    }
+  }
+  return 0;  // closed by server
+}
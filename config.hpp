@@ -6,7 +6,7 @@
 /*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
 /*                                                +#+#+#+#+#+   +#+           */
 /*   Created: 2021/02/24 15:31:12 by dnakano           #+#    #+#             */
-/*   Updated: 2021/02/25 08:01:30 by dnakano          ###   ########.fr       */
+/*   Updated: 2021/03/28 18:40:00 by dnakano          ###   ########.fr       */
 /*                                                                            */
 /* ************************************************************************** */
 
@@ -20,16 +20,182 @@
 // default port number
 #define DEFAULT_PORT 8088
 
-// time to timeout of select (in msec)
-#define SELECT_TIMEOUT_MS 2500
+// number of workers (event loops), 0 means number of online cpus
+#define WORKER_NUM 0
+
+// time to timeout of epoll_wait (in msec)
+// (timers of sessions are checked at least this often)
+#define EPOLL_TIMEOUT_MS 1000
+
+// max number of events to receive by one epoll_wait
+#define EPOLL_MAX_EVENTS 256
+
+// use edge triggered epoll (1) or level triggered epoll (0)
+#define EPOLL_EDGE_TRIGGERED 0
+
+// use io_uring (1) instead of epoll (0) to wait for fds, and to recv and
+// send with clients (epoll is used if kernel does not support io_uring)
+#define IO_URING_ENABLED 0
+
+// size of submission queue of io_uring
+#define IO_URING_ENTRIES 1024
+
+// max number of I/O calls for one ready fd in edge triggered mode
+// (session is processed again in next loop if not drained)
+#define EPOLL_EDGE_IO_MAX 16
 
 // que length of tcp socket
 #define SOCKET_QUE_LEN 128
 
-// buffer size
-#define BUFFER_SIZE 8096
+// max number of connections accepted in a loop of worker
+#define ACCEPT_BATCH_MAX 64
+
+// number of sessions allocated at once (reused after connection closed)
+#define SESSION_SLAB_SIZE 64
+
+// size of a block of I/O buffer
+// (request line and headers must fit in it, see REQUEST_HEADER_MAX)
+#define IOBUF_BLOCK_SIZE 16384
+
+// max number of free blocks of I/O buffer kept in each thread
+#define IOBUF_POOL_MAX 1024
+
+// max number of blocks sent by one writev
+#define IOBUF_IOV_MAX 16
+
+// max size of request line and headers (431 if exceeded)
+#define REQUEST_HEADER_MAX 8192
+
+// max size of request body (413 if exceeded)
+#define REQUEST_BODY_MAX 104857600
+
+// directory to serve files from
+#define DOCUMENT_ROOT "."
+
+// file to serve for "/"
+#define INDEX_FILE "hello.txt"
+
+// directory under DOCUMENT_ROOT that PUT and POST write files to
+// (only files directly in it, created at startup if none)
+#define UPLOAD_DIR "/upload/"
+
+// request target starting with this runs script under DOCUMENT_ROOT
+// (one process for each request, checked before CGI_PATH_PREFIX)
+#define CGI_SCRIPT_PREFIX "/cgi-bin/"
+
+// request target starting with this is passed to cgi worker
+#define CGI_PATH_PREFIX "/cgi"
+
+// number of cgi workers of each event loop (started when needed)
+#define CGI_POOL_SIZE 4
+
+// program of cgi worker (talks FastCGI records on fd 0)
+#define CGI_WORKER_PATH "./cgi_worker"
+
+// output of cgi worker buffered before it is streamed to client
+// (also sent earlier when worker has no more output for now)
+#define CGI_STREAM_BUFFER_SIZE 65536
+
+// output in pipe of cgi script spliced to client when at least this
+// (less is read and coalesced into a larger chunk)
+#define CGI_SPLICE_MIN 4096
+
+// request body to cgi received ahead of what cgi has read
+// (client is not read while this is buffered)
+#define CGI_BODY_BUFFER_SIZE 65536
+
+// request target to get metrics in prometheus text format
+#define METRICS_PATH "/metrics"
+
+// number of buckets of latency histogram (last one is over 2^30 usec)
+#define METRICS_HIST_BUCKETS 32
+
+// seconds to close connection waiting for next request
+#define KEEPALIVE_TIMEOUT_SEC 15
+
+// seconds to close connection sending nothing after accepted
+#define TIMEOUT_FIRST_BYTE_SEC 10
+
+// seconds to receive request line and headers from their first byte
+#define TIMEOUT_HEADER_SEC 20
+
+// seconds to close connection making no progress in body or response
+#define TIMEOUT_BODY_SEC 30
+
+// seconds to close session waiting for cgi (its worker is restarted)
+#define TIMEOUT_CGI_SEC 60
+
+// max number of requests on one connection
+#define KEEPALIVE_REQUEST_MAX 1000
+
+// max number of pipelined requests queued in a session
+#define PIPELINE_REQUEST_MAX 64
+
+// responses ready are sent when they reach this size
+#define PIPELINE_FLUSH_SIZE 65536
+
+// max bytes to send by one sendfile (not to stall other sessions)
+#define SENDFILE_MAX 1048576
+
+// seconds to trust cached file without checking it by stat()
+#define FILE_CACHE_VALID_SEC 1
+
+// max number of files kept open in cache
+#define FILE_CACHE_ENTRY_MAX 1024
+
+// files up to this size are cached with their contents
+#define FILE_CACHE_CONTENT_MAX 65536
+
+// max memory for contents in cache
+#define FILE_CACHE_MEMORY_MAX 67108864
+
+// threads doing blocking file I/O (open, write, sendfile) for all workers
+#define FILE_POOL_THREADS 4
+
+// request body to file received ahead of what is written
+// (client is not read while this is buffered)
+#define UPLOAD_BUFFER_SIZE 262144
+
+// max blocks of request body written to file by one writev
+// (UPLOAD_BUFFER_SIZE of body not aligned to blocks of IoBuffer)
+#define FILE_WRITE_IOV_MAX 17
+
+// suffix of temporary file an upload is written to before it is renamed
+// to the target (hidden as ".<name>.upload.XXXXXX" by mkostemp, and not
+// served to clients)
+#define UPLOAD_TEMP_SUFFIX ".upload."
+
+// extensions of files sent compressed if client accepts gzip or deflate
+#define COMPRESS_EXTENSIONS ".html .htm .txt .css .js .json .xml .svg .csv .md"
+
+// bodies smaller than this are sent without compression
+#define COMPRESS_MIN_SIZE 256
+
+// max number of ranges in Range (file is sent whole if more)
+#define RANGE_MAX 16
+
+// max size of file compressed by server (larger needs precompressed .gz)
+#define COMPRESS_FILE_MAX 1048576
+
+// compression level of files (compressed once and cached)
+#define COMPRESS_FILE_LEVEL 9
+
+// compression level of cgi output (compressed for each response)
+#define COMPRESS_STREAM_LEVEL 1
 
 // retry max time to retry to recv/send
 #define RETRY_TIME_MAX 10
 
+// min level of log compiled in (0: debug, 1: info, 2: warn, 3: error)
+#define LOG_LEVEL 1
+
+// bytes of log buffered in each thread (records are dropped if full)
+#define LOG_RING_SIZE 1048576
+
+// max length of a record of log
+#define LOG_RECORD_MAX 512
+
+// interval to write log buffered (in msec)
+#define LOG_FLUSH_INTERVAL_MS 50
+
 #endif /* CONFIG_HPP */
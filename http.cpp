@@ -0,0 +1,280 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   http.cpp                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/05 15:55:02 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/25 11:42:51 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#include "http.hpp"
+
+#include <strings.h>  // strncasecmp
+
+/*
+** function: getReasonPhrase
+**
+** returns reason phrase of http status
+*/
+
+const char* getReasonPhrase(int http_status) {
+  switch (http_status) {
+    case HTTP_200:
+      return "OK";
+    case HTTP_201:
+      return "Created";
+    case HTTP_206:
+      return "Partial Content";
+    case HTTP_400:
+      return "Bad Request";
+    case HTTP_403:
+      return "Forbidden";
+    case HTTP_404:
+      return "Not Found";
+    case HTTP_413:
+      return "Payload Too Large";
+    case HTTP_416:
+      return "Range Not Satisfiable";
+    case HTTP_418:
+      return "I'm a teapot";
+    case HTTP_431:
+      return "Request Header Fields Too Large";
+    case HTTP_500:
+      return "Internal Server Error";
+    case HTTP_501:
+      return "Not Implemented";
+    case HTTP_502:
+      return "Bad Gateway";
+    case HTTP_505:
+      return "HTTP Version Not Supported";
+    default:
+      return "Unknown";
+  }
+}
+
+/*
+** function: getStatusLine
+**
+** returns status line of http status (static string, not to be freed)
+*/
+
+const char* getStatusLine(int http_status) {
+  switch (http_status) {
+    case HTTP_200:
+      return "HTTP/1.1 200 OK\r\n";
+    case HTTP_201:
+      return "HTTP/1.1 201 Created\r\n";
+    case HTTP_206:
+      return "HTTP/1.1 206 Partial Content\r\n";
+    case HTTP_400:
+      return "HTTP/1.1 400 Bad Request\r\n";
+    case HTTP_403:
+      return "HTTP/1.1 403 Forbidden\r\n";
+    case HTTP_404:
+      return "HTTP/1.1 404 Not Found\r\n";
+    case HTTP_413:
+      return "HTTP/1.1 413 Payload Too Large\r\n";
+    case HTTP_416:
+      return "HTTP/1.1 416 Range Not Satisfiable\r\n";
+    case HTTP_418:
+      return "HTTP/1.1 418 I'm a teapot\r\n";
+    case HTTP_431:
+      return "HTTP/1.1 431 Request Header Fields Too Large\r\n";
+    case HTTP_500:
+      return "HTTP/1.1 500 Internal Server Error\r\n";
+    case HTTP_501:
+      return "HTTP/1.1 501 Not Implemented\r\n";
+    case HTTP_502:
+      return "HTTP/1.1 502 Bad Gateway\r\n";
+    case HTTP_505:
+      return "HTTP/1.1 505 HTTP Version Not Supported\r\n";
+    default:
+      return "HTTP/1.1 500 Internal Server Error\r\n";
+  }
+}
+
+/*
+** function: parseQvalue
+**
+** returns qvalue in parameters of an element of Accept-Encoding
+** (in thousandths, 1000 if not specified)
+*/
+
+static int parseQvalue(const char* param, const char* end) {
+  while (param < end) {
+    while (param < end && (*param == ';' || *param == ' ' || *param == '\t')) {
+      ++param;
+    }
+    if (end - param >= 2 && (*param == 'q' || *param == 'Q') &&
+        param[1] == '=') {
+      int q = 0;
+      int scale = 1000;
+      for (param += 2; param < end && *param != ';'; ++param) {
+        if (*param >= '0' && *param <= '9' && scale > 0) {
+          q += (*param - '0') * scale;
+          scale /= 10;
+        } else if (*param != '.') {
+          break;
+        }
+      }
+      return q > 1000 ? 1000 : q;
+    }
+    while (param < end && *param != ';') {
+      ++param;
+    }
+  }
+  return 1000;
+}
+
+/*
+** function: selectContentCoding
+**
+** choose content coding of response from value of Accept-Encoding
+**    - gzip is preferred to deflate if their qvalues are the same
+**    - coding with q=0 is not used, "*" is for codings not listed
+*/
+
+ContentCoding selectContentCoding(const char* value, size_t len) {
+  const char* end = value + len;
+  int q_gzip = -1;  // -1 if not listed
+  int q_deflate = -1;
+  int q_any = -1;
+
+  while (value < end) {
+    const char* next = value;
+    while (next < end && *next != ',') {
+      ++next;
+    }
+    while (value < next && (*value == ' ' || *value == '\t')) {
+      ++value;
+    }
+    const char* token_end = value;
+    while (token_end < next && *token_end != ';' && *token_end != ' ' &&
+           *token_end != '\t') {
+      ++token_end;
+    }
+    size_t token_len = token_end - value;
+    int q = parseQvalue(token_end, next);
+    if (token_len == 4 && strncasecmp(value, "gzip", 4) == 0) {
+      q_gzip = q;
+    } else if (token_len == 7 && strncasecmp(value, "deflate", 7) == 0) {
+      q_deflate = q;
+    } else if (token_len == 1 && *value == '*') {
+      q_any = q;
+    }
+    value = next + 1;
+  }
+  if (q_gzip == -1) {
+    q_gzip = q_any;
+  }
+  if (q_deflate == -1) {
+    q_deflate = q_any;
+  }
+  if (q_gzip > 0 && q_gzip >= q_deflate) {
+    return CODING_GZIP;
+  } else if (q_deflate > 0) {
+    return CODING_DEFLATE;
+  }
+  return CODING_IDENTITY;
+}
+
+/*
+** function: getContentCodingName
+**
+** returns name of content coding (NULL for identity)
+*/
+
+const char* getContentCodingName(ContentCoding coding) {
+  switch (coding) {
+    case CODING_GZIP:
+      return "gzip";
+    case CODING_DEFLATE:
+      return "deflate";
+    default:
+      return NULL;
+  }
+}
+
+/*
+** function: parseRangePos
+**
+** parse digits of a position in Range (returns -1 if none or too large)
+*/
+
+static off_t parseRangePos(const char** p, const char* end) {
+  const char* start = *p;
+  off_t pos = 0;
+
+  while (*p < end && **p >= '0' && **p <= '9') {
+    if (pos > (static_cast<off_t>(1) << 60) / 10) {
+      return -1;
+    }
+    pos = pos * 10 + (**p - '0');
+    ++*p;
+  }
+  return *p == start ? -1 : pos;
+}
+
+/*
+** function: parseRange
+**
+** parse "bytes=first-last, first-, -suffix, ..." into ranges of body
+**    - last beyond end of body is cut to the end
+**    - range starting after end of body (or empty suffix) is ignored
+**    - returns -1 for other units or broken syntax (Range is ignored then)
+*/
+
+int parseRange(const char* value, size_t len, off_t size,
+               std::vector<ByteRange>* ranges) {
+  const char* end = value + len;
+  const char* p = value;
+
+  ranges->clear();
+  if (len < 6 || strncasecmp(p, "bytes=", 6) != 0) {
+    return -1;
+  }
+  p += 6;
+  while (true) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+      ++p;
+    }
+    ByteRange range;
+    if (p < end && *p == '-') {  // last suffix bytes
+      ++p;
+      off_t suffix = parseRangePos(&p, end);
+      if (suffix == -1) {
+        return -1;
+      }
+      range.first = suffix < size ? size - suffix : 0;
+      range.last = size - 1;
+      if (suffix == 0 || size == 0) {
+        range.first = size;  // not satisfiable
+      }
+    } else {
+      range.first = parseRangePos(&p, end);
+      if (range.first == -1 || p == end || *p++ != '-') {
+        return -1;
+      }
+      range.last = parseRangePos(&p, end);
+      if (range.last == -1 || range.last >= size) {
+        range.last = size - 1;
+      } else if (range.last < range.first) {
+        return -1;
+      }
+    }
+    if (range.first < size) {
+      ranges->push_back(range);
+    }
+    while (p < end && (*p == ' ' || *p == '\t')) {
+      ++p;
+    }
+    if (p == end) {
+      return 0;
+    } else if (*p++ != ',') {
+      return -1;
+    }
+  }
+}
@@ -0,0 +1,68 @@
+/* ************************************************************************** */
+/*                                                                            */
+/*                                                        :::      ::::::::   */
+/*   http.hpp                                           :+:      :+:    :+:   */
+/*                                                    +:+ +:+         +:+     */
+/*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
+/*                                                +#+#+#+#+#+   +#+           */
+/*   Created: 2021/03/05 15:48:30 by dnakano           #+#    #+#             */
+/*   Updated: 2021/03/25 11:42:51 by dnakano          ###   ########.fr       */
+/*                                                                            */
+/* ************************************************************************** */
+
+#ifndef HTTP_HPP
+#define HTTP_HPP
+
+#include <stddef.h>
+#include <sys/types.h>  // off_t
+
+#include <vector>
+
+/*
+** header file for definitions of HTTP
+*/
+
+#define HTTP_200 200  // 200 OK
+#define HTTP_201 201  // 201 Created
+#define HTTP_206 206  // 206 Partial Content
+#define HTTP_400 400  // 400 Bad Request
+#define HTTP_403 403  // 403 Forbidden
+#define HTTP_404 404  // 404 Not Found
+#define HTTP_413 413  // 413 Payload Too Large
+#define HTTP_416 416  // 416 Range Not Satisfiable
+#define HTTP_418 418  // 418 I'm a teapot
+#define HTTP_431 431  // 431 Request Header Fields Too Large
+#define HTTP_500 500  // 500 Internal Server Error
+#define HTTP_501 501  // 501 Not Implemented
+#define HTTP_502 502  // 502 Bad Gateway
+#define HTTP_505 505  // 505 HTTP Version Not Supported
+
+// content coding of response body
+enum ContentCoding {
+  CODING_IDENTITY,  // not compressed
+  CODING_GZIP,      // gzip format
+  CODING_DEFLATE    // zlib format (called "deflate" in HTTP)
+};
+
+// range of bytes requested by Range (first and last are included)
+struct ByteRange {
+  off_t first;
+  off_t last;
+};
+
+// returns reason phrase of http status (e.g. "Not Found" for 404)
+const char* getReasonPhrase(int http_status);
+const char* getStatusLine(int http_status);
+
+// returns coding to use for value of Accept-Encoding
+ContentCoding selectContentCoding(const char* value, size_t len);
+
+// returns name of coding for Content-Encoding (e.g. "gzip")
+const char* getContentCodingName(ContentCoding coding);
+
+// parse value of Range for body of size bytes (returns -1 if invalid)
+// (ranges not satisfiable are not added, none is added if all are)
+int parseRange(const char* value, size_t len, off_t size,
+               std::vector<ByteRange>* ranges);
+
+#endif /* HTTP_HPP */
@@ -6,162 +6,126 @@
 /*   By: dnakano <dnakano@student.42tokyo.jp>       +#+  +:+       +#+        */
 /*                                                +#+#+#+#+#+   +#+           */
 /*   Created: 2021/02/24 15:18:18 by dnakano           #+#    #+#             */
-/*   Updated: 2021/03/01 19:59:36 by dnakano          ###   ########.fr       */
+/*   Updated: 2021/03/28 18:02:00 by dnakano          ###   ########.fr       */
 /*                                                                            */
 /* ************************************************************************** */
 
-#include <sys/select.h>
+#include <errno.h>
+#include <pthread.h>
 #include <signal.h>
+#include <sys/stat.h>  // mkdir
+#include <unistd.h>    // sysconf
 
 #include <exception>
 #include <iostream>
-#include <list>
-#include <string>
+#include <stdexcept>
 
-#include "Session.hpp"
-#include "Socket.hpp"
+#include "FileCache.hpp"
+#include "FilePool.hpp"
+#include "Logger.hpp"
+#include "Server.hpp"
 #include "config.hpp"
-#include <math.h>
 
-void server() {
-  int n_fd;           // number of fds ready to read/write (value from select)
-  int max_fd;         // maximum nubmer of fds (to pass select())
-  fd_set rfd;         // set of read fd
-  fd_set wfd;         // set of write fd
-  Socket sock;        // socket for listing
-  std::list<Session> sessions;
+/*
+** function: getWorkerNum
+**
+** returns number of workers (event loops) to run
+**    - WORKER_NUM 0 means one worker per online cpu
+*/
 
-  // initialize timeout of select
-  struct timeval tv_timeout;  // time to timeout
-  tv_timeout.tv_sec = SELECT_TIMEOUT_MS / 1000;
-  tv_timeout.tv_usec = (SELECT_TIMEOUT_MS * 1000) % 1000000;
+static int getWorkerNum() {
+  if (WORKER_NUM > 0) {
+    return WORKER_NUM;
+  }
+  long n_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+  return n_cpu > 0 ? static_cast<int>(n_cpu) : 1;
+}
 
-  // ignore sigchld signal
-  signal(SIGCHLD, SIG_IGN);
+/*
+** function: createUploadDir
+**
+** create UPLOAD_DIR if none (throws runtime_error if failed)
+*/
 
-  // initialize socket
-  sock.init(DEFAULT_PORT);
-  std::cout << "socket initialized" << std::endl;
-
-  // main loop
-  while (1) {
-    // initialize fd sets
-    n_fd = 0;
-    FD_ZERO(&rfd);
-    FD_ZERO(&wfd);
-
-    // set listing socket fd
-    FD_SET(sock.getFd(), &rfd);
-    max_fd = sock.getFd();
-
-    // set sessions fd
-    for (std::list<Session>::iterator itr = sessions.begin();
-         itr != sessions.end(); ++itr) {
-      if (itr->getStatus() == SESSION_FOR_CLIENT_RECV) {
-        FD_SET(itr->getSockFd(), &rfd);
-        max_fd = std::max(max_fd, itr->getSockFd());
-      } else if (itr->getStatus() == SESSION_FOR_FILE_READ) {
-        FD_SET(itr->getFileFd(), &rfd);
-        max_fd = std::max(max_fd, itr->getFileFd());
-      } else if (itr->getStatus() == SESSION_FOR_FILE_WRITE) {
-        FD_SET(itr->getFileFd(), &wfd);
-        max_fd = std::max(max_fd, itr->getFileFd());
-      } else if (itr->getStatus() == SESSION_FOR_CGI_WRITE) {
-        FD_SET(itr->getCgiInputFd(), &wfd);
-        max_fd = std::max(max_fd, itr->getCgiInputFd());
-      } else if (itr->getStatus() == SESSION_FOR_CGI_READ) {
-        FD_SET(itr->getCgiOutputFd(), &rfd);
-        max_fd = std::max(max_fd, itr->getCgiOutputFd());
-      } else if (itr->getStatus() == SESSION_FOR_CLIENT_SEND) {
-        FD_SET(itr->getSockFd(), &wfd);
-        max_fd = std::max(max_fd, itr->getSockFd());
-      }
-    }
+static void createUploadDir() {
+  if (mkdir(DOCUMENT_ROOT UPLOAD_DIR, 0777) == -1 && errno != EEXIST) {
+    throw std::runtime_error("webserv: cannot create " UPLOAD_DIR);
+  }
+}
 
-    // wait for fds getting ready
-    std::cout << "selecting..." << std::endl;
-    n_fd = select(max_fd + 1, &rfd, &wfd, NULL, &tv_timeout);
-    if (n_fd == -1) {
-      std::cout << "[error]: select" << std::endl;
-    } else if (n_fd == 0) {
-      continue;
-    }
+/*
+** function: runWorker
+**
+** thread routine to run main loop of worker
+*/
+
+static void* runWorker(void* arg) {
+  Server* server = static_cast<Server*>(arg);
+  try {
+    server->run();
+  } catch (const std::exception& e) {
+    LOG_ERROR("worker " << server->getId() << ": " << e.what());
+  }
+  return NULL;
+}
+
+/*
+** function: startServer
+**
+** initialize all workers and run them
+**    - all workers are initialized before starting (to fail fast on bind)
+**    - worker 0 runs in main thread, others run in their own threads
+*/
+
+static void startServer() {
+  int n_worker = getWorkerNum();
+  Server* servers = new Server[n_worker];
+  pthread_t* threads = new pthread_t[n_worker];
 
-    // check each session if it is ready to recv/send
-    for (std::list<Session>::iterator itr = sessions.begin();
-         itr != sessions.end() && n_fd > 0;) {
-      if (FD_ISSET(itr->getSockFd(), &rfd)) {
-        if (itr->recvReq() == -1) {
-          itr = sessions.erase(itr);    // delete session if failed to recv
-        } else {
-          std::cout << "[webserv] received request data" << std::endl;
-          ++itr;
-        }
-        n_fd--;
-      } else if (FD_ISSET(itr->getFileFd(), &rfd)) {
-        if (itr->readFromFile() == -1) {
-          itr = sessions.erase(itr);    // delete session if failed or ended
-        } else {
-          std::cout << "[webserv] read data from file" << std::endl;
-          ++itr;
-        }
-        n_fd--;
-      } else if (FD_ISSET(itr->getFileFd(), &wfd)) {
-        if (itr->writeToFile() == -1) {
-          itr = sessions.erase(itr);    // delete session if failed or ended
-        } else {
-          std::cout << "[webserv] write data to file" << std::endl;
-          ++itr;
-        }
-        n_fd--;
-      } else if (FD_ISSET(itr->getCgiInputFd(), &wfd)) {
-        if (itr->writeToCgiProcess() == -1) {
-          itr = sessions.erase(itr);    // delete session if failed
-        } else {
-          std::cout << "[webserv] wrote data to cgi" << std::endl;
-          ++itr;
-        }
-        n_fd--;
-      } else if (FD_ISSET(itr->getCgiOutputFd(), &rfd)) {
-        if (itr->readFromCgiProcess() == -1) {
-          itr = sessions.erase(itr);    // delete session if failed
-        } else {
-          std::cout << "[webserv] read data from cgi" << std::endl;
-          ++itr;
-        }
-        n_fd--;
-      } else if (FD_ISSET(itr->getSockFd(), &wfd)) {
-        if (itr->sendRes() != 0) {
-          std::cout << "[webserv] sent response data" << std::endl;
-          itr = sessions.erase(itr);    // delete session if failed or ended
-        } else {
-          ++itr;
-        }
-        n_fd--;
-      } else {
-        ++itr;
-      }
+  try {
+    for (int i = 0; i < n_worker; ++i) {
+      servers[i].init(i, DEFAULT_PORT);
     }
+  } catch (...) {
+    delete[] servers;
+    delete[] threads;
+    throw;
+  }
+  LOG_INFO("start " << n_worker << " worker(s)");
 
-    // accept new connection and add to sessions list
-    if (FD_ISSET(sock.getFd(), &rfd)) {
-      int accepted_fd;
-      // accept all incoming connections (rest of n_fd)
-      while (n_fd-- > 0) {
-        accepted_fd = sock.acceptRequest();
-        if (accepted_fd >= 0) {
-          sessions.push_back(Session(accepted_fd));
-        }
-      }
+  for (int i = 1; i < n_worker; ++i) {
+    if (pthread_create(&threads[i], NULL, runWorker, &servers[i]) != 0) {
+      LOG_ERROR("failed to start worker " << i);
+      n_worker = i;
+      break;
     }
   }
+  runWorker(&servers[0]);
+  for (int i = 1; i < n_worker; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+  delete[] servers;
+  delete[] threads;
 }
 
 int main(void) {
+  // ignore sigchld signal
+  signal(SIGCHLD, SIG_IGN);
+
+  // ignore sigpipe signal (writev to closed socket returns EPIPE instead)
+  signal(SIGPIPE, SIG_IGN);
+
+  // create file cache shared by workers before starting them
+  FileCache::getInstance();
+
   try {
-    server();
-  } catch (std::exception e) {
-    std::cout << e.what() << std::endl;
+    createUploadDir();
+    Logger::getInstance().start();
+    FilePool::getInstance().start(FILE_POOL_THREADS);
+    startServer();
+  } catch (const std::exception& e) {
+    Logger::getInstance().flush();  // write log left before exit
+    std::cerr << e.what() << std::endl;
   }
   return 1;
 }